@@ -1,8 +1,18 @@
 #include <cassert>
+#include <filesystem>
 #include <zstd.h>
 
 #include "BinaryIO.h"
 
+#ifdef _WIN32
+    #define WIN32_LEAN_AND_MEAN
+    #define NOMINMAX
+    #include <Windows.h>
+#else
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
 namespace glim::io {
 
 void WriteCompressed(std::ostream& os, const void* ptr, size_t size) {
@@ -64,4 +74,39 @@ void ReadCompressed(std::istream& is, void* ptr, size_t size) {
     }
 }
 
-};  // namespace glim::io
\ No newline at end of file
+#ifdef _WIN32
+void CommitFile(const std::string& tempPath, const std::string& destPath) {
+    HANDLE file = CreateFileA(tempPath.c_str(), GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        throw std::ios_base::failure("Failed to open file for flushing");
+    }
+    bool flushed = FlushFileBuffers(file);
+    CloseHandle(file);
+
+    if (!flushed || !MoveFileExA(tempPath.c_str(), destPath.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+        throw std::ios_base::failure("Failed to commit file");
+    }
+}
+#else
+static bool SyncPath(const char* path, int flags) {
+    int fd = open(path, flags);
+    if (fd < 0) return false;
+
+    bool ok = fsync(fd) == 0;
+    close(fd);
+    return ok;
+}
+void CommitFile(const std::string& tempPath, const std::string& destPath) {
+    if (!SyncPath(tempPath.c_str(), O_RDONLY)) {
+        throw std::ios_base::failure("Failed to flush file");
+    }
+    if (rename(tempPath.c_str(), destPath.c_str()) != 0) {
+        throw std::ios_base::failure("Failed to rename file");
+    }
+    // Directory entry must also be flushed for the rename to be durable
+    auto parentDir = std::filesystem::absolute(destPath).parent_path();
+    SyncPath(parentDir.c_str(), O_RDONLY | O_DIRECTORY);
+}
+#endif
+
+};  // namespace glim::io
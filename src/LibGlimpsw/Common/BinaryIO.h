@@ -38,6 +38,10 @@ inline void WriteStr(std::ostream& os, std::string_view str) {
     os.write(str.data(), (std::streamsize)str.size());
 }
 
+// Flushes `tempPath` to disk and renames it over `destPath`. Readers will either see the
+// old or the new file contents, never a partially written one.
+void CommitFile(const std::string& tempPath, const std::string& destPath);
+
 inline size_t BytesAvail(std::istream& is) {
     std::streampos curr = is.tellg();
     is.seekg(0, std::ios::end);
@@ -33,6 +33,12 @@ struct Camera {
     }
     glm::mat4 GetProjMatrix() { return glm::perspective(glm::radians(FieldOfView), AspectRatio, NearZ, FarZ); }
 
+    // Sets smoothed values to the current position and rotation, for use without Update().
+    void SnapView() {
+        ViewRotation = glm::eulerAngleXY(-Euler.y, Euler.x);
+        ViewPosition = Position;
+    }
+
     void Update() {
         ImGuiIO& io = ImGui::GetIO();
         float sensitivity = 0.008f;
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <type_traits>
+
+namespace glim {
+
+// Incremental 64-bit non-cryptographic hash. Data is consumed in 8-byte words,
+// so results depend on how input is split across Write() calls.
+struct Hasher {
+    uint64_t State = 0x9E3779B97F4A7C15ull;
+
+    void Write(const void* data, size_t size) {
+        const uint8_t* ptr = (const uint8_t*)data;
+        const uint8_t* end = ptr + size;
+
+        for (; ptr + 8 <= end; ptr += 8) {
+            uint64_t word;
+            std::memcpy(&word, ptr, 8);
+            Mix(word);
+        }
+        uint64_t tail = 0;
+        std::memcpy(&tail, ptr, (size_t)(end - ptr));
+        Mix(tail ^ (size << 56));
+    }
+
+    template<typename T>
+        requires std::is_trivially_copyable_v<T>
+    void Write(const T& value) {
+        Write(&value, sizeof(T));
+    }
+    void WriteStr(std::string_view str) { Write(str.data(), str.size()); }
+
+    uint64_t Finish() const {
+        uint64_t h = State;
+        h ^= h >> 33;
+        h *= 0xFF51AFD7ED558CCDull;
+        h ^= h >> 33;
+        h *= 0xC4CEB9FE1A85EC53ull;
+        h ^= h >> 33;
+        return h;
+    }
+
+private:
+    void Mix(uint64_t word) {
+        word *= 0xBF58476D1CE4E5B9ull;
+        word ^= word >> 31;
+        State = std::rotl(State ^ word, 27) * 0x94D049BB133111EBull;
+    }
+};
+
+};  // namespace glim
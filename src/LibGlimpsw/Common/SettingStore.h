@@ -111,6 +111,8 @@ struct TimeStat {
     void AddSample(double elapsedMs);
 
     void GetElapsedMs(double& mean, double& stdDev) const;
+    // Returns the most recent sample, or 0 if there are none.
+    double GetLastMs() const { return _sampleIdx > 0 ? _samples[(_sampleIdx - 1) % std::size(_samples)] : 0.0; }
 
     void Draw(std::string_view label) const {
         double mean, stdDev;
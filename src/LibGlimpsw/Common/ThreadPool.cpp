@@ -0,0 +1,145 @@
+#include "ThreadPool.h"
+
+#include <chrono>
+
+namespace glim {
+
+static uint64_t PackRange(uint32_t begin, uint32_t end) { return (uint64_t)end << 32 | begin; }
+
+ThreadPool::ThreadPool(uint32_t numWorkers) {
+    if (numWorkers == 0) {
+        numWorkers = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    for (uint32_t i = 0; i < numWorkers; i++) {
+        _workers.push_back(std::make_unique<Worker>());
+    }
+    // Worker 0 is the thread calling ParallelFor()
+    for (uint32_t i = 1; i < numWorkers; i++) {
+        _workers[i]->Thread = std::jthread(&ThreadPool::WorkerFn, this, i);
+    }
+}
+ThreadPool::~ThreadPool() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _exit = true;
+    lock.unlock();
+
+    _jobAvail.notify_all();
+
+    for (auto& worker : _workers) {
+        if (worker->Thread.joinable()) {
+            worker->Thread.join();
+        }
+    }
+}
+
+void ThreadPool::ParallelFor(uint32_t count, const std::function<void(uint32_t, uint32_t)>& fn) {
+    if (count == 0) return;
+
+    uint32_t numWorkers = GetNumWorkers();
+    _jobFn = &fn;
+
+    for (uint32_t i = 0; i < numWorkers; i++) {
+        uint32_t begin = (uint32_t)((uint64_t)count * i / numWorkers);
+        uint32_t end = (uint32_t)((uint64_t)count * (i + 1) / numWorkers);
+
+        _workers[i]->Range.store(PackRange(begin, end), std::memory_order_relaxed);
+        _workers[i]->Stats = {};
+    }
+    _numActiveWorkers.store(numWorkers - 1, std::memory_order_relaxed);
+
+    // Mutex release makes the stores above visible to woken workers
+    std::unique_lock<std::mutex> lock(_mutex);
+    _jobId++;
+    lock.unlock();
+    _jobAvail.notify_all();
+
+    RunItems(0);
+
+    // Wait for all workers to leave the job, so that no one touches it after we return.
+    while (_numActiveWorkers.load(std::memory_order_acquire) != 0) {
+        std::this_thread::yield();
+    }
+    _jobFn = nullptr;
+}
+
+void ThreadPool::WorkerFn(uint32_t workerIdx) {
+    uint64_t lastJobId = 0;
+
+    while (true) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (_jobId == lastJobId && !_exit) {
+            _jobAvail.wait(lock);
+        }
+        if (_exit) break;
+
+        lastJobId = _jobId;
+        lock.unlock();
+
+        RunItems(workerIdx);
+        _numActiveWorkers.fetch_sub(1, std::memory_order_release);
+    }
+}
+
+void ThreadPool::RunItems(uint32_t workerIdx) {
+    Worker& worker = *_workers[workerIdx];
+    auto startTime = std::chrono::steady_clock::now();
+    uint32_t itemIdx;
+
+    while (TakeItem(worker, itemIdx) || StealItems(workerIdx, itemIdx)) {
+        (*_jobFn)(itemIdx, workerIdx);
+        worker.Stats.NumItems++;
+    }
+    worker.Stats.BusyMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+bool ThreadPool::TakeItem(Worker& worker, uint32_t& itemIdx) {
+    uint64_t range = worker.Range.load(std::memory_order_relaxed);
+
+    while (true) {
+        uint32_t begin = (uint32_t)range, end = (uint32_t)(range >> 32);
+        if (begin >= end) return false;
+
+        if (worker.Range.compare_exchange_weak(range, PackRange(begin + 1, end), std::memory_order_acq_rel)) {
+            itemIdx = begin;
+            return true;
+        }
+    }
+}
+
+bool ThreadPool::StealItems(uint32_t workerIdx, uint32_t& itemIdx) {
+    while (true) {
+        // Pick the victim with the most remaining items
+        Worker* victim = nullptr;
+        uint64_t victimRange = 0;
+        uint32_t maxRemaining = 0;
+
+        for (uint32_t i = 0; i < _workers.size(); i++) {
+            if (i == workerIdx) continue;
+
+            uint64_t range = _workers[i]->Range.load(std::memory_order_relaxed);
+            uint32_t begin = (uint32_t)range, end = (uint32_t)(range >> 32);
+
+            if (end > begin && end - begin > maxRemaining) {
+                victim = _workers[i].get();
+                victimRange = range;
+                maxRemaining = end - begin;
+            }
+        }
+        if (victim == nullptr) return false;
+
+        uint32_t begin = (uint32_t)victimRange, end = (uint32_t)(victimRange >> 32);
+        uint32_t mid = begin + (end - begin) / 2;
+
+        if (victim->Range.compare_exchange_strong(victimRange, PackRange(begin, mid), std::memory_order_acq_rel)) {
+            // Our own range is empty at this point, so no one else will be trying to modify it.
+            Worker& worker = *_workers[workerIdx];
+            worker.Range.store(PackRange(mid + 1, end), std::memory_order_release);
+            worker.Stats.NumSteals++;
+
+            itemIdx = mid;
+            return true;
+        }
+    }
+}
+
+};  // namespace glim
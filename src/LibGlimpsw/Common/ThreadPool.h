@@ -0,0 +1,61 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace glim {
+
+// Persistent worker pool for data-parallel loops.
+//
+// Each job is split into one contiguous range of items per worker, so that neighboring items
+// are likely processed by the same thread. Workers that run out of items steal the upper half
+// of the largest remaining range from other workers.
+struct ThreadPool {
+    struct WorkerStats {
+        double BusyMs = 0;  // Time spent running items
+        uint32_t NumItems = 0;
+        uint32_t NumSteals = 0;
+    };
+
+    // Creates a pool with the given number of workers, including the calling thread.
+    // If zero, uses the number of hardware threads.
+    ThreadPool(uint32_t numWorkers = 0);
+    ~ThreadPool();
+
+    // Calls `fn(itemIdx, workerIdx)` for each item in [0, count), and blocks until all are done.
+    // The calling thread participates as worker 0. Not re-entrant.
+    void ParallelFor(uint32_t count, const std::function<void(uint32_t, uint32_t)>& fn);
+
+    uint32_t GetNumWorkers() const { return (uint32_t)_workers.size(); }
+
+    // Stats from the last call to ParallelFor(), indexed by worker.
+    const WorkerStats& GetWorkerStats(uint32_t workerIdx) const { return _workers[workerIdx]->Stats; }
+
+private:
+    struct alignas(64) Worker {
+        std::atomic_uint64_t Range;  // [begin, end) packed as (end << 32 | begin)
+        WorkerStats Stats;
+        std::jthread Thread;
+    };
+    std::vector<std::unique_ptr<Worker>> _workers;
+
+    std::mutex _mutex;
+    std::condition_variable _jobAvail;
+    uint64_t _jobId = 0;  // protected by _mutex
+    bool _exit = false;   // protected by _mutex
+
+    const std::function<void(uint32_t, uint32_t)>* _jobFn = nullptr;
+    std::atomic_uint32_t _numActiveWorkers = 0;
+
+    void WorkerFn(uint32_t workerIdx);
+    void RunItems(uint32_t workerIdx);
+    bool TakeItem(Worker& worker, uint32_t& itemIdx);
+    bool StealItems(uint32_t workerIdx, uint32_t& itemIdx);
+};
+
+};  // namespace glim
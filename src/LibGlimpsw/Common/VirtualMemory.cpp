@@ -0,0 +1,94 @@
+#include "VirtualMemory.h"
+
+#include <cassert>
+#include <new>
+
+#ifdef _WIN32
+    #define WIN32_LEAN_AND_MEAN
+    #define NOMINMAX
+    #include <Windows.h>
+#else
+    #include <sys/mman.h>
+    #include <unistd.h>
+#endif
+
+namespace glim {
+
+static size_t AlignDown(size_t x, size_t align) { return x & ~(align - 1); }
+static size_t AlignUp(size_t x, size_t align) { return (x + align - 1) & ~(align - 1); }
+
+#ifdef _WIN32
+VirtualBuffer::VirtualBuffer(size_t size) {
+    _size = AlignUp(size, GetPageSize());
+    _data = (uint8_t*)VirtualAlloc(NULL, _size, MEM_RESERVE, PAGE_NOACCESS);
+
+    if (_data == nullptr) {
+        throw std::bad_alloc();
+    }
+}
+VirtualBuffer::~VirtualBuffer() {
+    VirtualFree(_data, 0, MEM_RELEASE);
+}
+
+void VirtualBuffer::Commit(size_t offset, size_t size) {
+    assert(offset + size <= _size);
+    size_t start = AlignDown(offset, GetPageSize());
+    size_t end = AlignUp(offset + size, GetPageSize());
+
+    if (VirtualAlloc(_data + start, end - start, MEM_COMMIT, PAGE_READWRITE) == nullptr) {
+        throw std::bad_alloc();
+    }
+}
+void VirtualBuffer::Decommit(size_t offset, size_t size) {
+    assert(offset + size <= _size);
+    size_t start = AlignUp(offset, GetPageSize());
+    size_t end = AlignDown(offset + size, GetPageSize());
+
+    if (start < end) {
+        VirtualFree(_data + start, end - start, MEM_DECOMMIT);
+    }
+}
+
+size_t VirtualBuffer::GetPageSize() {
+    static size_t pageSize = [] {
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        return (size_t)info.dwPageSize;
+    }();
+    return pageSize;
+}
+#else
+VirtualBuffer::VirtualBuffer(size_t size) {
+    _size = AlignUp(size, GetPageSize());
+    void* ptr = mmap(nullptr, _size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+    if (ptr == MAP_FAILED) {
+        throw std::bad_alloc();
+    }
+    _data = (uint8_t*)ptr;
+}
+VirtualBuffer::~VirtualBuffer() {
+    munmap(_data, _size);
+}
+
+// Anonymous pages are faulted in on first write, so there is nothing to do here.
+void VirtualBuffer::Commit(size_t offset, size_t size) {
+    assert(offset + size <= _size);
+}
+void VirtualBuffer::Decommit(size_t offset, size_t size) {
+    assert(offset + size <= _size);
+    size_t start = AlignUp(offset, GetPageSize());
+    size_t end = AlignDown(offset + size, GetPageSize());
+
+    if (start < end) {
+        madvise(_data + start, end - start, MADV_DONTNEED);
+    }
+}
+
+size_t VirtualBuffer::GetPageSize() {
+    static size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+    return pageSize;
+}
+#endif
+
+};  // namespace glim
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace glim {
+
+// Large buffer backed by reserved address space, with physical memory committed on demand.
+// Uncommitted pages must not be accessed on Windows; on Linux they read as zero.
+struct VirtualBuffer {
+    VirtualBuffer(size_t size);
+    ~VirtualBuffer();
+
+    VirtualBuffer(const VirtualBuffer&) = delete;
+    VirtualBuffer& operator=(const VirtualBuffer&) = delete;
+
+    uint8_t* Data() const { return _data; }
+    size_t Size() const { return _size; }
+
+    // Ensures that all pages overlapping the given range are backed by memory.
+    void Commit(size_t offset, size_t size);
+    // Releases pages fully contained by the given range. Their contents are lost and will read as zeros once re-committed.
+    void Decommit(size_t offset, size_t size);
+
+    static size_t GetPageSize();
+
+private:
+    uint8_t* _data;
+    size_t _size;
+};
+
+};  // namespace glim
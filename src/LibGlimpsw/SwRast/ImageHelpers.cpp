@@ -27,12 +27,14 @@ StbImage StbImage::Load(std::string_view path, PixelType type) {
     };
 }
 
-StbImage StbImage::Create(uint32_t width, uint32_t height) {
+StbImage StbImage::Create(uint32_t width, uint32_t height, PixelType type) {
+    size_t bytesPerPixel = type == PixelType::RGB_F32 ? 12 : 4;
+
     return {
         .Width = width,
         .Height = height,
-        .Type = PixelType::RGBA_U8,
-        .Data = { (uint8_t*)std::malloc(width * height * 4), &std::free }
+        .Type = type,
+        .Data = { (uint8_t*)std::malloc(width * height * bytesPerPixel), &std::free }
     };
 }
 
@@ -43,6 +45,13 @@ void StbImage::SavePng(std::string_view path) {
     stbi_write_png(path.data(), (int)Width, (int)Height, 4, Data.get(), (int)Width * 4);
 }
 
+void StbImage::SaveHdr(std::string_view path) {
+    if (Type != PixelType::RGB_F32) {
+        throw std::runtime_error("Unsupported pixel format");
+    }
+    stbi_write_hdr(path.data(), (int)Width, (int)Height, 3, (float*)Data.get());
+}
+
 namespace texutil {
 
 RgbaTexture2D LoadImage(std::string_view path, uint32_t mipLevels) {
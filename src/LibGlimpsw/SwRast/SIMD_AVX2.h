@@ -156,6 +156,8 @@ SIMD_INLINE void set_if(VMask cond, VInt& dest, VInt x) { dest = csel(cond, x, d
 
 SIMD_INLINE bool any(VMask cond) { return _mm256_movemask_epi8(cond) != 0; }
 SIMD_INLINE bool all(VMask cond) { return _mm256_movemask_epi8(cond) == 0xFFFFFFFF; }
+// Number of set lanes in mask
+SIMD_INLINE uint32_t popcnt(VMask cond) { return (uint32_t)std::popcount((uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(cond))); }
 
 // 16-bit linear interpolation with 15-bit interpolant: a + (b - a) * t
 // mulhrs(a, b) = (a * b + (1 << 14)) >> 15
@@ -183,7 +185,12 @@ SIMD_INLINE VMask ucmp_lt(VInt a, VInt b) {
 // TODO
 SIMD_INLINE VInt bitrev(VInt x);
 SIMD_INLINE VInt lzcnt(VInt x);
-SIMD_INLINE VInt tzcnt(VInt x);
+// tzcnt(x) = exponent of float(x & -x). 1 << 31 converts to -2^31, which has the same exponent.
+SIMD_INLINE VInt tzcnt(VInt x) {
+    VInt lsb = x & (0 - x);
+    VInt exp = (re2i(conv2f(lsb)) >> 23 & 255) - 127;
+    return csel(x == 0, VInt(32), exp);
+}
 
 // Calculate coarse partial derivatives for a 4x2 fragment.
 // https://gamedev.stackexchange.com/a/130933
@@ -220,11 +220,13 @@ struct StbImage {
     PixelType Type;
     std::unique_ptr<uint8_t[], Deleter> Data = { nullptr, &std::free };
 
-    static StbImage Create(uint32_t width, uint32_t height);
+    static StbImage Create(uint32_t width, uint32_t height, PixelType type = PixelType::RGBA_U8);
     static StbImage Load(std::string_view path, PixelType type = PixelType::RGBA_U8);
 
     // Assumes `Type == RGBA_U8`
     void SavePng(std::string_view path);
+    // Saves as Radiance HDR. Assumes `Type == RGB_F32`
+    void SaveHdr(std::string_view path);
 };
 
 namespace texutil {
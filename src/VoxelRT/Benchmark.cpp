@@ -0,0 +1,516 @@
+// Offline benchmark for the CPU renderer.
+// Replays a camera path in headless mode and reports frame time percentiles, ray throughput,
+// traversal and memory metrics as JSON, plus optional per-frame CSV.
+//
+// Usage: VoxelRT-Bench [options]
+//   --map <file>         Load map from file, instead of generating terrain
+//   --model <file>       Voxelize model into a 2048^3 map like the main app, instead of generating terrain
+//   --terrain <n>        Generate n*7*n sectors of terrain (default 24)
+//   --path <file>        Camera path recorded by the main app (default: built-in flyover)
+//   --frames <n>         Number of measured frames (default: path length)
+//   --warmup <n>         Number of frames to render before measuring (default 4)
+//   --size <w>x<h>       Render resolution (default 1280x720)
+//   --bounces <n>        Number of light bounces (default 1)
+//   --wavefront          Trace bounces in wavefront mode instead of per packet
+//   --no-sort            Don't reorder bounce rays in wavefront mode
+//   --persistent-lanes   Refill terminated lanes with queued rays in wavefront mode, for primary rays and bounces
+//   --anisotropic        Filter occupancy masks by ray octant during traversal
+//   --step-cache         Reuse masks gathered on previous traversal steps, and prefetch the next brick
+//   --coarse <n>         Iterations or distance before bounce rays go coarse, 0 for exact (default 0)
+//   --beam               March a conservative cone per 8x8 pixel beam to start primary rays closer to surfaces
+//   --depth-reuse        Start primary rays near the reprojected hits of the previous frame
+//   --lighting-rate <n>  Trace bounce rays for 1 in n pixels and upsample the rest, n = 1, 2 or 4 (default 1)
+//   --irradiance-cache   Reuse first bounce irradiance from a world space cache, needs 2+ bounces
+//   --denoise <n>        Run the CPU denoiser with n a-trous passes, 0 to disable (default 0)
+//   --accumulate <noise> Render a progressive still at the last pose, until tiles reach the given relative noise
+//   --max-spp <n>        Max samples per pixel for --accumulate (default 1024)
+//   --json <file>        Write summary to file instead of stdout
+//   --csv <file>         Write per-frame metrics
+//   --image <file>       Save last frame as PNG, or HDR if the extension is .hdr
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <utility>
+
+#include "Renderer.h"
+#include "TerrainGenerator.h"
+#include "CameraPath.h"
+
+#ifdef _WIN32
+    #define WIN32_LEAN_AND_MEAN
+    #define NOMINMAX
+    #include <Windows.h>
+    #include <Psapi.h>
+#endif
+
+using Clock = std::chrono::steady_clock;
+
+static double GetElapsedMs(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+// Returns the peak resident memory of the process, in bytes.
+static uint64_t GetPeakMemoryUsage() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) {
+        return pmc.PeakWorkingSetSize;
+    }
+    return 0;
+#else
+    std::ifstream is("/proc/self/status");
+    std::string line;
+
+    while (std::getline(is, line)) {
+        if (line.starts_with("VmHWM:")) {
+            return std::stoull(line.substr(6)) * 1024;
+        }
+    }
+    return 0;
+#endif
+}
+
+struct BenchOptions {
+    std::string MapPath, ModelPath;
+    uint32_t TerrainSize = 24;
+    std::string CameraPathFile;
+    uint32_t NumFrames = 0;
+    uint32_t NumWarmupFrames = 4;
+    glm::uvec2 ViewSize = { 1280, 720 };
+    uint32_t NumLightBounces = 1;
+    bool UseWavefront = false;
+    bool SortBounceRays = true;
+    bool UsePersistentLanes = false;
+    bool UseAnisotropicLods = false;
+    bool CacheStepMasks = false;
+    uint32_t CoarseBounceThreshold = 0;
+    bool UseBeamPrepass = false;
+    bool UseDepthReuse = false;
+    CpuRenderer::LightingRate BounceRayRate = CpuRenderer::LightingRate::Full;
+    bool UseIrradianceCache = false;
+    uint32_t NumDenoiserPasses = 0;
+    float AccumTargetNoise = 0;
+    uint32_t AccumMaxSamples = 1024;
+    std::string JsonPath, CsvPath, ImagePath;
+
+    void Parse(int argc, char** args) {
+        for (int i = 1; i < argc; i++) {
+            std::string_view arg = args[i];
+
+            const auto next = [&]() -> const char* {
+                if (i + 1 >= argc) {
+                    throw std::invalid_argument("Missing value for " + std::string(arg));
+                }
+                return args[++i];
+            };
+
+            if (arg == "--map") {
+                MapPath = next();
+            } else if (arg == "--model") {
+                ModelPath = next();
+            } else if (arg == "--terrain") {
+                TerrainSize = (uint32_t)std::stoul(next());
+            } else if (arg == "--path") {
+                CameraPathFile = next();
+            } else if (arg == "--frames") {
+                NumFrames = (uint32_t)std::stoul(next());
+            } else if (arg == "--warmup") {
+                NumWarmupFrames = (uint32_t)std::stoul(next());
+            } else if (arg == "--size") {
+                if (sscanf(next(), "%ux%u", &ViewSize.x, &ViewSize.y) != 2) {
+                    throw std::invalid_argument("Invalid size, expected <width>x<height>");
+                }
+            } else if (arg == "--bounces") {
+                NumLightBounces = (uint32_t)std::stoul(next());
+            } else if (arg == "--wavefront") {
+                UseWavefront = true;
+            } else if (arg == "--no-sort") {
+                SortBounceRays = false;
+            } else if (arg == "--persistent-lanes") {
+                UsePersistentLanes = true;
+            } else if (arg == "--anisotropic") {
+                UseAnisotropicLods = true;
+            } else if (arg == "--step-cache") {
+                CacheStepMasks = true;
+            } else if (arg == "--coarse") {
+                CoarseBounceThreshold = (uint32_t)std::stoul(next());
+            } else if (arg == "--beam") {
+                UseBeamPrepass = true;
+            } else if (arg == "--depth-reuse") {
+                UseDepthReuse = true;
+            } else if (arg == "--lighting-rate") {
+                uint32_t rate = (uint32_t)std::stoul(next());
+                if (rate != 1 && rate != 2 && rate != 4) {
+                    throw std::invalid_argument("Invalid lighting rate, expected 1, 2 or 4");
+                }
+                BounceRayRate = rate == 4 ? CpuRenderer::LightingRate::Quarter
+                              : rate == 2 ? CpuRenderer::LightingRate::Checkerboard
+                                          : CpuRenderer::LightingRate::Full;
+            } else if (arg == "--irradiance-cache") {
+                UseIrradianceCache = true;
+            } else if (arg == "--denoise") {
+                NumDenoiserPasses = (uint32_t)std::stoul(next());
+            } else if (arg == "--accumulate") {
+                AccumTargetNoise = std::stof(next());
+            } else if (arg == "--max-spp") {
+                AccumMaxSamples = (uint32_t)std::stoul(next());
+            } else if (arg == "--json") {
+                JsonPath = next();
+            } else if (arg == "--csv") {
+                CsvPath = next();
+            } else if (arg == "--image") {
+                ImagePath = next();
+            } else {
+                throw std::invalid_argument("Unknown argument " + std::string(arg));
+            }
+        }
+    }
+};
+
+struct FrameRecord {
+    double FrameMs, SyncMs, TraceMs;
+    uint64_t NumRays, NumTraversalIters, NumTraversalSteps;
+    uint64_t NumPrimaryRays, NumPrimaryIters, NumPrimarySteps, NumBeamIters;
+    double DepthReuseRate;
+    double IrradianceCacheHitRate;
+    double DenoiseMs;
+};
+
+// Generates terrain deterministically, same as the main app.
+static void GenerateTerrain(const std::shared_ptr<VoxelMap>& map, uint32_t sizeXZ) {
+    TerrainGenerator generator(map);
+    uint32_t numRequested = 0, numReceived = 0;
+
+    for (uint32_t y = 0; y < 7; y++) {
+        for (uint32_t z = 0; z < sizeXZ; z++) {
+            for (uint32_t x = 0; x < sizeXZ; x++) {
+                generator.RequestSector(glm::ivec3(x, y, z));
+                numRequested++;
+            }
+        }
+    }
+    while (numReceived < numRequested) {
+        auto [sectorPos, sector] = generator.Poll();
+
+        if (sector == nullptr) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+        uint32_t sectorIdx = WorldSectorIndexer::GetIndex(sectorPos);
+        map->MarkDirty(sectorIdx, sector->GetAllocationMask());
+        map->Sectors[sectorIdx] = std::move(*sector);
+        numReceived++;
+    }
+    map->Palette[245] = { .Color = { 70, 150, 64 } };
+    map->Palette[246] = { .Color = { 110, 150, 64 } };
+    map->Palette[247] = { .Color = { 138, 160, 72 } };
+    map->Palette[248] = { .Color = { 60, 130, 56 } };
+}
+
+// Straight flyover across the map while panning side to side.
+static CameraPath CreateDefaultPath(uint32_t numFrames) {
+    CameraPath path;
+
+    for (uint32_t i = 0; i < numFrames; i++) {
+        float t = i / (float)numFrames;
+
+        path.Frames.push_back({
+            .Position = glm::dvec3(256.0 + t * 512.0, 128.0, 512.0),
+            .Euler = glm::vec2(1.52f + sinf(t * glm::two_pi<float>()) * 0.8f, -0.4f),
+            .FieldOfView = 90.0f,
+        });
+    }
+    return path;
+}
+
+static double GetPercentile(std::vector<double> values, double p) {
+    if (values.empty()) return 0;
+
+    std::sort(values.begin(), values.end());
+    size_t idx = (size_t)std::ceil(p / 100.0 * values.size());
+    return values[std::clamp(idx, (size_t)1, values.size()) - 1];
+}
+
+int main(int argc, char** args) {
+    BenchOptions opts;
+
+    try {
+        opts.Parse(argc, args);
+    } catch (std::exception& ex) {
+        std::cerr << ex.what() << std::endl;
+        return 1;
+    }
+
+    auto map = std::make_shared<VoxelMap>();
+
+    auto loadStart = Clock::now();
+    if (!opts.MapPath.empty()) {
+        try {
+            map->Deserialize(opts.MapPath);
+        } catch (std::exception& ex) {
+            std::cerr << "Failed to load map: " << ex.what() << std::endl;
+            return 1;
+        }
+    } else if (!opts.ModelPath.empty()) {
+        try {
+            map->LoadOrVoxelizeModel(opts.ModelPath, glm::uvec3(0), glm::uvec3(2048), "logs/voxel_cache/");
+        } catch (std::exception& ex) {
+            std::cerr << "Failed to load model: " << ex.what() << std::endl;
+            return 1;
+        }
+    } else {
+        GenerateTerrain(map, opts.TerrainSize);
+    }
+    double loadMs = GetElapsedMs(loadStart);
+
+    // Serialization metrics, comparing Z-order against hash map order
+    double serializeMs[2], deserializeMs;
+    size_t serializedSize[2];
+    {
+        std::string mortonData;
+
+        for (uint32_t i = 0; i < 2; i++) {
+            std::ostringstream os;
+            auto start = Clock::now();
+            map->Serialize(os, i == 0);
+            serializeMs[i] = GetElapsedMs(start);
+            serializedSize[i] = os.view().size();
+
+            if (i == 0) mortonData = std::move(os).str();
+        }
+        std::istringstream is(std::move(mortonData));
+        VoxelMap loadedMap;
+        auto start = Clock::now();
+        loadedMap.Deserialize(is);
+        deserializeMs = GetElapsedMs(start);
+    }
+
+    CameraPath path;
+    if (!opts.CameraPathFile.empty()) {
+        try {
+            path.Load(opts.CameraPathFile);
+        } catch (std::exception& ex) {
+            std::cerr << "Failed to load camera path: " << ex.what() << std::endl;
+            return 1;
+        }
+    } else {
+        path = CreateDefaultPath(120);
+    }
+    uint32_t numFrames = opts.NumFrames != 0 ? opts.NumFrames : (uint32_t)path.Frames.size();
+
+    CpuRenderer renderer(map);
+    renderer.NumLightBounces = opts.NumLightBounces;
+    renderer.UseWavefront = opts.UseWavefront;
+    renderer.SortBounceRays = opts.SortBounceRays;
+    renderer.UsePersistentLanes = opts.UsePersistentLanes;
+    renderer.UseAnisotropicLods = opts.UseAnisotropicLods;
+    renderer.CacheStepMasks = opts.CacheStepMasks;
+    renderer.CoarseBounceRays = opts.CoarseBounceThreshold != 0;
+    renderer.CoarseBounceThreshold = opts.CoarseBounceThreshold;
+    renderer.UseBeamPrepass = opts.UseBeamPrepass;
+    renderer.UseDepthReuse = opts.UseDepthReuse;
+    renderer.BounceRayRate = opts.BounceRayRate;
+    renderer.UseIrradianceCache = opts.UseIrradianceCache;
+    renderer.NumDenoiserPasses = opts.NumDenoiserPasses;
+
+    glim::Camera cam = {};
+    cam.AspectRatio = opts.ViewSize.x / (float)opts.ViewSize.y;
+
+    std::vector<FrameRecord> frames;
+    double initialSyncMs = 0;
+    uint32_t initialSyncBricks = 0;
+
+    for (uint32_t i = 0; i < opts.NumWarmupFrames + numFrames; i++) {
+        auto& kf = path.Frames[i % path.Frames.size()];
+        cam.Position = kf.Position;
+        cam.Euler = kf.Euler;
+        cam.FieldOfView = kf.FieldOfView;
+        cam.SnapView();
+
+        auto start = Clock::now();
+        renderer.RenderFrame(cam, opts.ViewSize);
+        double frameMs = GetElapsedMs(start);
+
+        auto& stats = renderer.GetLastFrameStats();
+
+        if (i == 0) {
+            initialSyncMs = stats.SyncMs;
+            initialSyncBricks = stats.NumSyncedBricks;
+        }
+        if (i >= opts.NumWarmupFrames) {
+            frames.push_back({
+                frameMs, stats.SyncMs, stats.TraceMs,
+                stats.NumRays, stats.NumTraversalIters, stats.NumTraversalSteps,
+                stats.NumPrimaryRays, stats.NumPrimaryIters, stats.NumPrimarySteps, stats.NumBeamIters,
+                stats.DepthReuseRate, stats.IrradianceCacheHitRate, stats.DenoiseMs,
+            });
+        }
+    }
+
+    // Sync throughput, forcing a full re-upload of every sector in view.
+    // Cached occupancy masks are dropped so that the mask builder is measured too.
+    double resyncMs;
+    uint32_t resyncBricks;
+    {
+        for (auto& [sectorIdx, sector] : map->Sectors) {
+            sector.OccupancyCacheMask = 0;
+        }
+        map->MarkAllDirty();
+        renderer.RenderFrame(cam, opts.ViewSize);
+
+        resyncMs = renderer.GetLastFrameStats().SyncMs;
+        resyncBricks = renderer.GetLastFrameStats().NumSyncedBricks;
+    }
+
+    // Single-threaded occupancy mask builder throughput
+    double occupancyMs;
+    uint64_t occupancyBricks = 0, numOccupiedVoxels = 0;
+    {
+        BrickOccupancy occupancy;
+        auto start = Clock::now();
+
+        for (auto& [sectorIdx, sector] : map->Sectors) {
+            for (uint32_t i : BitIter(sector.GetAllocationMask())) {
+                std::as_const(sector).GetBrick(i)->ComputeOccupancy(occupancy);
+                occupancyBricks++;
+
+                for (uint64_t cell : occupancy.Cells) {
+                    numOccupiedVoxels += (uint64_t)std::popcount(cell);
+                }
+            }
+        }
+        occupancyMs = GetElapsedMs(start);
+    }
+
+    // Progressive still at the last camera pose, replaces the last frame for --image
+    CpuRenderer::AccumulationStats accumStats;
+    if (opts.AccumTargetNoise > 0) {
+        accumStats = renderer.Accumulate(cam, opts.ViewSize, { .MaxSamples = opts.AccumMaxSamples, .TargetNoise = opts.AccumTargetNoise });
+    }
+
+    if (!opts.ImagePath.empty()) {
+        if (opts.ImagePath.ends_with(".hdr")) {
+            renderer.GetRadianceImage().SaveHdr(opts.ImagePath);
+        } else {
+            renderer.GetColorImage().SavePng(opts.ImagePath);
+        }
+    }
+
+    // Summarize
+    std::vector<double> frameTimes, traceTimes;
+    double totalTraceMs = 0;
+    uint64_t totalRays = 0, totalIters = 0, totalSteps = 0;
+    uint64_t totalPrimaryRays = 0, totalPrimaryIters = 0, totalPrimarySteps = 0, totalBeamIters = 0;
+    double totalDepthReuseRate = 0, totalCacheHitRate = 0, totalDenoiseMs = 0;
+
+    for (auto& f : frames) {
+        frameTimes.push_back(f.FrameMs);
+        traceTimes.push_back(f.TraceMs);
+        totalTraceMs += f.TraceMs;
+        totalRays += f.NumRays;
+        totalIters += f.NumTraversalIters;
+        totalSteps += f.NumTraversalSteps;
+        totalPrimaryRays += f.NumPrimaryRays;
+        totalPrimaryIters += f.NumPrimaryIters;
+        totalPrimarySteps += f.NumPrimarySteps;
+        totalBeamIters += f.NumBeamIters;
+        totalDepthReuseRate += f.DepthReuseRate;
+        totalCacheHitRate += f.IrradianceCacheHitRate;
+        totalDenoiseMs += f.DenoiseMs;
+    }
+
+    std::ostringstream json;
+    json.precision(6);
+    json << "{\n";
+    json << "  \"simd_width\": " << simd::VectorWidth << ",\n";
+#if SIMD_AVX512
+    json << "  \"isa\": \"avx512\",\n";
+#else
+    json << "  \"isa\": \"avx2\",\n";
+#endif
+    json << "  \"width\": " << opts.ViewSize.x << ",\n";
+    json << "  \"height\": " << opts.ViewSize.y << ",\n";
+    json << "  \"light_bounces\": " << opts.NumLightBounces << ",\n";
+    json << "  \"wavefront\": " << (opts.UseWavefront ? "true" : "false") << ",\n";
+    json << "  \"sort_bounce_rays\": " << (opts.UseWavefront && opts.SortBounceRays ? "true" : "false") << ",\n";
+    json << "  \"persistent_lanes\": " << (opts.UseWavefront && opts.UsePersistentLanes ? "true" : "false") << ",\n";
+    json << "  \"anisotropic_lods\": " << (opts.UseAnisotropicLods ? "true" : "false") << ",\n";
+    json << "  \"step_mask_cache\": " << (opts.CacheStepMasks ? "true" : "false") << ",\n";
+    json << "  \"coarse_bounce_threshold\": " << opts.CoarseBounceThreshold << ",\n";
+    json << "  \"beam_prepass\": " << (opts.UseBeamPrepass ? "true" : "false") << ",\n";
+    json << "  \"depth_reuse\": " << (opts.UseDepthReuse ? "true" : "false") << ",\n";
+    json << "  \"lighting_rate\": \"" << magic_enum::enum_name(opts.BounceRayRate) << "\",\n";
+    json << "  \"irradiance_cache\": " << (opts.UseIrradianceCache && opts.NumLightBounces >= 2 ? "true" : "false") << ",\n";
+    json << "  \"denoiser_passes\": " << opts.NumDenoiserPasses << ",\n";
+    json << "  \"num_frames\": " << frames.size() << ",\n";
+    json << "  \"num_sectors\": " << map->Sectors.size() << ",\n";
+    json << "  \"num_occupied_voxels\": " << numOccupiedVoxels << ",\n";
+    json << "  \"load_ms\": " << loadMs << ",\n";
+    json << "  \"serialize_ms\": " << serializeMs[0] << ",\n";
+    json << "  \"serialize_bytes\": " << serializedSize[0] << ",\n";
+    json << "  \"serialize_unordered_ms\": " << serializeMs[1] << ",\n";
+    json << "  \"serialize_unordered_bytes\": " << serializedSize[1] << ",\n";
+    json << "  \"deserialize_ms\": " << deserializeMs << ",\n";
+    json << "  \"initial_sync_ms\": " << initialSyncMs << ",\n";
+    json << "  \"initial_sync_bricks\": " << initialSyncBricks << ",\n";
+    json << "  \"resync_ms\": " << resyncMs << ",\n";
+    json << "  \"resync_bricks_per_sec\": " << (resyncMs > 0 ? resyncBricks / (resyncMs / 1000.0) : 0.0) << ",\n";
+    json << "  \"occupancy_bricks_per_sec\": " << (occupancyMs > 0 ? occupancyBricks / (occupancyMs / 1000.0) : 0.0) << ",\n";
+    json << "  \"frame_ms\": { ";
+    json << "\"p50\": " << GetPercentile(frameTimes, 50) << ", ";
+    json << "\"p90\": " << GetPercentile(frameTimes, 90) << ", ";
+    json << "\"p99\": " << GetPercentile(frameTimes, 99) << ", ";
+    json << "\"max\": " << GetPercentile(frameTimes, 100) << " },\n";
+    json << "  \"trace_ms\": { ";
+    json << "\"p50\": " << GetPercentile(traceTimes, 50) << ", ";
+    json << "\"p90\": " << GetPercentile(traceTimes, 90) << ", ";
+    json << "\"p99\": " << GetPercentile(traceTimes, 99) << ", ";
+    json << "\"max\": " << GetPercentile(traceTimes, 100) << " },\n";
+    json << "  \"denoise_ms\": " << (frames.size() > 0 ? totalDenoiseMs / frames.size() : 0.0) << ",\n";
+    json << "  \"rays_per_sec\": " << (totalTraceMs > 0 ? totalRays / (totalTraceMs / 1000.0) : 0.0) << ",\n";
+    json << "  \"iters_per_ray\": " << (totalRays > 0 ? totalIters / (double)totalRays : 0.0) << ",\n";
+    json << "  \"primary_iters_per_ray\": " << (totalPrimaryRays > 0 ? totalPrimaryIters / (double)totalPrimaryRays : 0.0) << ",\n";
+    json << "  \"beam_iters_per_primary_ray\": " << (totalPrimaryRays > 0 ? totalBeamIters / (double)totalPrimaryRays : 0.0) << ",\n";
+    json << "  \"depth_reuse_rate\": " << (frames.size() > 0 ? totalDepthReuseRate / frames.size() : 0.0) << ",\n";
+    json << "  \"irradiance_cache_hit_rate\": " << (frames.size() > 0 ? totalCacheHitRate / frames.size() : 0.0) << ",\n";
+    json << "  \"rays_per_frame\": " << (frames.size() > 0 ? totalRays / (double)frames.size() : 0.0) << ",\n";
+    json << "  \"lane_utilization\": " << (totalSteps > 0 ? totalIters / (double)(totalSteps * simd::VectorWidth) : 0.0) << ",\n";
+    json << "  \"primary_lane_utilization\": " << (totalPrimarySteps > 0 ? totalPrimaryIters / (double)(totalPrimarySteps * simd::VectorWidth) : 0.0) << ",\n";
+    if (opts.AccumTargetNoise > 0) {
+        json << "  \"accumulation\": { ";
+        json << "\"target_noise\": " << opts.AccumTargetNoise << ", ";
+        json << "\"samples_per_sec\": " << accumStats.SamplesPerSec << ", ";
+        json << "\"elapsed_ms\": " << accumStats.ElapsedMs << ", ";
+        json << "\"time_to_target_ms\": " << accumStats.TimeToTargetMs << ", ";
+        json << "\"mean_spp\": " << accumStats.NumSamples / (double)((opts.ViewSize.x & ~3u) * (opts.ViewSize.y & ~3u)) << ", ";
+        json << "\"max_spp\": " << accumStats.MaxSamplesPerPixel << ", ";
+        json << "\"converged_tiles\": " << accumStats.NumConvergedTiles << ", ";
+        json << "\"num_tiles\": " << accumStats.NumTiles << ", ";
+        json << "\"max_noise\": " << accumStats.MaxNoise << " },\n";
+    }
+    json << "  \"peak_memory_bytes\": " << GetPeakMemoryUsage() << "\n";
+    json << "}\n";
+
+    if (!opts.JsonPath.empty()) {
+        std::ofstream(opts.JsonPath, std::ios::trunc) << json.str();
+    } else {
+        std::cout << json.str();
+    }
+
+    if (!opts.CsvPath.empty()) {
+        std::ofstream csv(opts.CsvPath, std::ios::trunc);
+        csv << "frame,frame_ms,sync_ms,trace_ms,rays,traversal_iters,traversal_steps\n";
+
+        for (size_t i = 0; i < frames.size(); i++) {
+            auto& f = frames[i];
+            csv << i << ',' << f.FrameMs << ',' << f.SyncMs << ',' << f.TraceMs << ',' << f.NumRays << ',' << f.NumTraversalIters << ',' << f.NumTraversalSteps << '\n';
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <fstream>
+#include <stdexcept>
+#include <string_view>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// Sequence of camera poses sampled once per frame, for replaying in benchmarks.
+// Stored as text, one "x y z yaw pitch fov" line per frame.
+struct CameraPath {
+    struct Keyframe {
+        glm::dvec3 Position;
+        glm::vec2 Euler;  // yaw, pitch
+        float FieldOfView;
+    };
+    std::vector<Keyframe> Frames;
+
+    void Load(std::string_view filename) {
+        std::ifstream is(filename.data());
+
+        if (!is.is_open()) {
+            throw std::runtime_error("File not found");
+        }
+        Frames.clear();
+
+        Keyframe kf;
+        while (is >> kf.Position.x >> kf.Position.y >> kf.Position.z >> kf.Euler.x >> kf.Euler.y >> kf.FieldOfView) {
+            Frames.push_back(kf);
+        }
+        if (Frames.empty()) {
+            throw std::runtime_error("Camera path is empty");
+        }
+    }
+    void Save(std::string_view filename) const {
+        std::ofstream os(filename.data(), std::ios::trunc);
+        os.precision(17);
+
+        for (auto& kf : Frames) {
+            os << kf.Position.x << ' ' << kf.Position.y << ' ' << kf.Position.z << ' ';
+            os << kf.Euler.x << ' ' << kf.Euler.y << ' ' << kf.FieldOfView << '\n';
+        }
+    }
+};
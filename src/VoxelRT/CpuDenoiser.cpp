@@ -0,0 +1,408 @@
+#include "CpuDenoiser.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <SwRast/SIMD.h>
+#include <SwRast/Texture.h>
+
+#include "CpuFramebuffer.h"
+#include "GBuffer.h"
+
+using namespace simd;
+
+// Same as in the shaders
+static VFloat GetLuminance(VFloat r, VFloat g, VFloat b) {
+    return r * 0.299f + g * 0.587f + b * 0.114f;
+}
+static VFloat3 UnpackNormal(VInt packed) {
+    return { conv2f((packed & 3) - 1), conv2f((packed >> 2 & 3) - 1), conv2f((packed >> 4 & 3) - 1) };
+}
+static VFloat3 GetWorldPos(VFloat x, VFloat y, VFloat depth, const glm::mat4& invProj) {
+    VFloat4 pos = TransformVector(invProj, { x, y, depth, 1.0f });
+    return VFloat3(pos) * (16.0f / pos.w);
+}
+// exp(-x)
+static VFloat ExpNeg(VFloat x) {
+    return approx_exp2(x * -1.44269504f);
+}
+
+void CpuDenoiser::Resize(glm::uvec2 size) {
+    _size = size;
+    _stride = size.x + PadX * 2;
+    size_t planeSize = (size_t)_stride * size.y;
+
+    // Zero depth rejects all history samples
+    _normals.assign(planeSize, 0);
+    _prevNormals.assign(planeSize, 0);
+    _depth.assign(planeSize, 0.0f);
+    _prevDepth.assign(planeSize, 0.0f);
+    _historyLen.assign(planeSize, 0.0f);
+    _prevHistoryLen.assign(planeSize, 0.0f);
+
+    for (uint32_t i = 0; i < 2; i++) {
+        _moments[i].assign(planeSize, 0.0f);
+        _prevMoments[i].assign(planeSize, 0.0f);
+    }
+    for (uint32_t i = 0; i < 4; i++) {
+        _irradiance[i].assign(planeSize, 0.0f);
+        _history[i].assign(planeSize, 0.0f);
+        _filterTemp[0][i].assign(planeSize, 0.0f);
+        _filterTemp[1][i].assign(planeSize, 0.0f);
+    }
+}
+
+void CpuDenoiser::Denoise(Framebuffer& fb, const glm::mat4& proj, glm::dvec3 viewPos, bool resetHistory, glim::ThreadPool& threadPool) {
+    if (_size != glm::uvec2(fb.Width, fb.Height)) {
+        Resize(glm::uvec2(fb.Width, fb.Height));
+    }
+    _historyProj = _currentProj;
+    _historyPos = _currentPos;
+    _currentProj = proj;
+    _currentPos = viewPos;
+
+    _invProj = GBuffer::GetInverseProjScreenMat(_currentProj, _size);
+    _historyInvProj = GBuffer::GetInverseProjScreenMat(_historyProj, _size);
+    _originDelta = glm::vec3(_currentPos - _historyPos);
+
+    std::swap(_normals, _prevNormals);
+    std::swap(_depth, _prevDepth);
+    std::swap(_moments, _prevMoments);
+    std::swap(_historyLen, _prevHistoryLen);
+
+    uint32_t numTileRows = _size.y / simd::TileHeight;
+    threadPool.ParallelFor(numTileRows, [&](uint32_t tileY, uint32_t workerIdx) { LoadTiles(fb, tileY); });
+    threadPool.ParallelFor(_size.y, [&](uint32_t y, uint32_t workerIdx) { Reproject(y, resetHistory); });
+
+    uint32_t numPasses = std::min(NumPasses, MaxPasses);
+    const IrradianceBuffer* output = &_history;
+
+    if (numPasses == 0) {
+        std::swap(_history, _irradiance);
+    } else {
+        threadPool.ParallelFor(_size.y, [&](uint32_t y, uint32_t workerIdx) { EstimateVariance(y, _filterTemp[0]); });
+
+        IrradianceBuffer* src = &_filterTemp[0];
+        IrradianceBuffer* dest = &_filterTemp[1];
+
+        for (uint32_t i = 0; i < numPasses; i++) {
+            threadPool.ParallelFor(_size.y, [&](uint32_t y, uint32_t workerIdx) { FilterAtrous(y, i, *src, *dest); });
+
+            // Output of the first pass is the history for the next frame
+            if (i == 0) {
+                std::swap(_history, *dest);
+                src = &_history;
+                dest = &_filterTemp[0];
+            } else {
+                IrradianceBuffer* next = src == &_history ? &_filterTemp[1] : src;
+                src = dest;
+                dest = next;
+            }
+        }
+        output = src;
+    }
+    threadPool.ParallelFor(numTileRows, [&](uint32_t tileY, uint32_t workerIdx) { StoreTiles(fb, tileY, *output); });
+}
+
+void CpuDenoiser::LoadTiles(const Framebuffer& fb, uint32_t tileY) {
+    const Framebuffer::Tile* tile = &fb.Tiles[tileY * fb.TileStride];
+    uint32_t y = tileY * simd::TileHeight;
+
+    for (uint32_t x = 0; x < _size.x; x += simd::TileWidth, tile++) {
+        VFloat2 irradianceRG = swr::pixfmt::RG16f::Unpack(tile->IrradianceRG);
+        VFloat2 irradianceBX = swr::pixfmt::RG16f::Unpack(tile->IrradianceBX);
+        VInt normal = tile->Albedo >> 24 & 63;
+
+        for (uint32_t i = 0; i < simd::VectorWidth; i++) {
+            uint32_t idx = (y + i / simd::TileWidth) * _stride + PadX + x + i % simd::TileWidth;
+
+            _irradiance[0][idx] = irradianceRG.x[i];
+            _irradiance[1][idx] = irradianceRG.y[i];
+            _irradiance[2][idx] = irradianceBX.x[i];
+            _irradiance[3][idx] = 0.0f;
+            _depth[idx] = tile->Depth[i];
+            _normals[idx] = normal[i];
+        }
+    }
+}
+
+void CpuDenoiser::StoreTiles(Framebuffer& fb, uint32_t tileY, const IrradianceBuffer& src) {
+    Framebuffer::Tile* tile = &fb.Tiles[tileY * fb.TileStride];
+    uint32_t y = tileY * simd::TileHeight;
+    VInt offsets = simd::TileOffsetsX + simd::TileOffsetsY * (int32_t)_stride;
+
+    for (uint32_t x = 0; x < _size.x; x += simd::TileWidth, tile++) {
+        VInt idx = offsets + (int32_t)(y * _stride + PadX + x);
+
+        VFloat r = VFloat::gather<4>(src[0].data(), idx);
+        VFloat g = VFloat::gather<4>(src[1].data(), idx);
+        VFloat b = VFloat::gather<4>(src[2].data(), idx);
+
+        tile->IrradianceRG = swr::pixfmt::RG16f::Pack({ r, g });
+        tile->IrradianceBX = swr::pixfmt::RG16f::Pack({ b });
+    }
+}
+
+// Temporal accumulation, see Reproject.comp
+void CpuDenoiser::Reproject(uint32_t y, bool resetHistory) {
+    const float* depthRow = GetRow(_depth, y);
+    const int32_t* normalRow = GetRow(_normals, y);
+    const float* prevHistoryLenRow = GetRow(_prevHistoryLen, y);
+
+    float* irradianceRows[4] = { GetRow(_irradiance[0], y), GetRow(_irradiance[1], y), GetRow(_irradiance[2], y), GetRow(_irradiance[3], y) };
+    float* momentRows[2] = { GetRow(_moments[0], y), GetRow(_moments[1], y) };
+    float* historyLenRow = GetRow(_historyLen, y);
+
+    for (uint32_t x = 0; x < _size.x; x += simd::VectorWidth) {
+        VInt xs = (int32_t)x + simd::LaneIdx;
+        VFloat depth = VFloat::load(&depthRow[x]);
+        VMask mask = (depth > 0.0f) & (xs < (int32_t)_size.x);
+
+        VFloat3 worldPos = GetWorldPos(conv2f(xs), (float)y, depth, _invProj);
+        VFloat4 prevNDC = TransformVector(_historyProj, { worldPos + VFloat3(_originDelta), 1.0f });
+        VFloat prevX = (prevNDC.x / prevNDC.w * 0.5f + 0.5f) * (float)_size.x - 0.5f;
+        VFloat prevY = (prevNDC.y / prevNDC.w * 0.5f + 0.5f) * (float)_size.y - 0.5f;
+        VInt prevXi = floor2i(prevX), prevYi = floor2i(prevY);
+        VFloat prevXf = prevX - conv2f(prevXi), prevYf = prevY - conv2f(prevYi);
+
+        mask &= simd::ucmp_lt(prevXi, (int32_t)_size.x) & simd::ucmp_lt(prevYi, (int32_t)_size.y);
+
+        VInt centerNormalId = VInt::load(&normalRow[x]);
+        VFloat3 centerNormal = UnpackNormal(centerNormalId);
+
+        VFloat3 prevIrradiance = 0.0f;
+        VFloat2 prevMoments = { 0.0f, 0.0f };
+        VFloat wsum = 0.0f;
+        VFloat historyLen = VFloat::load(&prevHistoryLenRow[x]);
+
+        for (uint32_t i = 0; i < 4 && any(mask); i++) {
+            VInt sampleX = prevXi + (int32_t)(i & 1);
+            VInt sampleY = prevYi + (int32_t)(i >> 1);
+            VMask sampleMask = mask & simd::ucmp_lt(sampleX, (int32_t)_size.x) & simd::ucmp_lt(sampleY, (int32_t)_size.y);
+            VInt sampleIdx = sampleY * (int32_t)_stride + sampleX + (int32_t)PadX;
+
+            // Normals are axis aligned, so the dot product check is the same as equality
+            VInt sampleNormalId = VInt::mask_gather<4>(_prevNormals.data(), sampleIdx, sampleMask);
+            VFloat sampleDepth = VFloat::mask_gather<4>(_prevDepth.data(), sampleIdx, sampleMask);
+            sampleMask &= (sampleNormalId == centerNormalId) & (sampleDepth > 0.0f);
+
+            // Plane distance check (ReBLUR)
+            VFloat3 sampleWorldPos = GetWorldPos(conv2f(sampleX), conv2f(sampleY), sampleDepth, _historyInvProj);
+            VFloat planeDist = abs(dot(worldPos - sampleWorldPos + VFloat3(_originDelta), centerNormal));
+            sampleMask &= planeDist <= 6.0f;
+
+            if (!any(sampleMask)) continue;
+
+            VFloat w = ((i & 1) != 0 ? prevXf : 1.0f - prevXf) * ((i >> 1) != 0 ? prevYf : 1.0f - prevYf);
+            w = csel(sampleMask, w, 0.0f);
+
+            prevIrradiance.x += VFloat::mask_gather<4>(_history[0].data(), sampleIdx, sampleMask) * w;
+            prevIrradiance.y += VFloat::mask_gather<4>(_history[1].data(), sampleIdx, sampleMask) * w;
+            prevIrradiance.z += VFloat::mask_gather<4>(_history[2].data(), sampleIdx, sampleMask) * w;
+            prevMoments.x += VFloat::mask_gather<4>(_prevMoments[0].data(), sampleIdx, sampleMask) * w;
+            prevMoments.y += VFloat::mask_gather<4>(_prevMoments[1].data(), sampleIdx, sampleMask) * w;
+            wsum += w;
+
+            // This helps minimize smearing after disocclusion
+            VFloat sampleHistoryLen = VFloat::mask_gather<4>(_prevHistoryLen.data(), sampleIdx, sampleMask);
+            historyLen = csel(sampleMask, min(historyLen, sampleHistoryLen + 1.0f), historyLen);
+        }
+        mask &= wsum >= 0.001f;
+
+        VFloat rcpWeight = 1.0f / max(wsum, 0.001f);
+        prevIrradiance *= rcpWeight;
+        prevMoments.x *= rcpWeight;
+        prevMoments.y *= rcpWeight;
+
+        if (resetHistory) historyLen = min(historyLen, 6.0f);
+        VFloat blendFactor = 1.0f / (historyLen + 1.0f);
+
+        VFloat3 currIrradiance = { VFloat::load(&irradianceRows[0][x]), VFloat::load(&irradianceRows[1][x]), VFloat::load(&irradianceRows[2][x]) };
+        VFloat3 newIrradiance = {
+            lerp(prevIrradiance.x, currIrradiance.x, blendFactor),
+            lerp(prevIrradiance.y, currIrradiance.y, blendFactor),
+            lerp(prevIrradiance.z, currIrradiance.z, blendFactor),
+        };
+        VFloat luma = GetLuminance(newIrradiance.x, newIrradiance.y, newIrradiance.z);
+        VFloat momentBlendFactor = max(blendFactor, 0.5f);
+        VFloat newMoment1 = lerp(prevMoments.x, luma, momentBlendFactor);
+        VFloat newMoment2 = lerp(prevMoments.y, luma * luma, momentBlendFactor);
+        VFloat variance = max(newMoment2 - newMoment1 * newMoment1, 0.0f);
+
+        // Rejected pixels keep the noisy input and restart history
+        csel(mask, newIrradiance.x, currIrradiance.x).store(&irradianceRows[0][x]);
+        csel(mask, newIrradiance.y, currIrradiance.y).store(&irradianceRows[1][x]);
+        csel(mask, newIrradiance.z, currIrradiance.z).store(&irradianceRows[2][x]);
+        csel(mask, variance, 0.0f).store(&irradianceRows[3][x]);
+        csel(mask, newMoment1, 0.0f).store(&momentRows[0][x]);
+        csel(mask, newMoment2, 0.0f).store(&momentRows[1][x]);
+        csel(mask, min(historyLen + 1.0f, 64.0f), 0.0f).store(&historyLenRow[x]);
+    }
+}
+
+// Spatial variance estimate for pixels with short history, see varianceEstim() in Filter.comp
+void CpuDenoiser::EstimateVariance(uint32_t y, IrradianceBuffer& dest) {
+    const IrradianceBuffer& src = _irradiance;
+    const float* depthRow = GetRow(_depth, y);
+    const int32_t* normalRow = GetRow(_normals, y);
+    const float* historyLenRow = GetRow(_historyLen, y);
+
+    const int32_t r = 3;
+    const float rcpLumaPhi = 1.0f / 10.0f;
+
+    for (uint32_t x = 0; x < _size.x; x += simd::VectorWidth) {
+        VInt xs = (int32_t)x + simd::LaneIdx;
+        VFloat centerDepth = VFloat::load(&depthRow[x]);
+        VFloat historyLen = VFloat::load(&historyLenRow[x]);
+
+        VFloat4 center = {
+            VFloat::load(&GetRow(src[0], y)[x]),
+            VFloat::load(&GetRow(src[1], y)[x]),
+            VFloat::load(&GetRow(src[2], y)[x]),
+            VFloat::load(&GetRow(src[3], y)[x]),
+        };
+        VMask estimMask = (historyLen <= 4.0f) & (centerDepth >= 0.0f);
+
+        if (any(estimMask)) {
+            VInt centerNormalId = VInt::load(&normalRow[x]);
+            VFloat centerLuma = GetLuminance(center.x, center.y, center.z);
+
+            VFloat3 sumIrradiance = 0.0f;
+            VFloat2 sumMoments = { 0.0f, 0.0f };
+            VFloat wsum = 0.0f;
+
+            for (int32_t ky = -r; ky <= r; ky++) {
+                uint32_t sy = y + ky;
+                if (sy >= _size.y) continue;
+
+                for (int32_t kx = -r; kx <= r; kx++) {
+                    uint32_t offset = sy * _stride + PadX + x + kx;
+                    VMask sampleMask = simd::ucmp_lt(xs + kx, (int32_t)_size.x);
+
+                    VFloat3 irradiance = { VFloat::load(&src[0][offset]), VFloat::load(&src[1][offset]), VFloat::load(&src[2][offset]) };
+                    VFloat luma = GetLuminance(irradiance.x, irradiance.y, irradiance.z);
+                    sampleMask &= VInt::load(&_normals[offset]) == centerNormalId;
+
+                    // FIXME: this won't do anything, depth should be linear
+                    VFloat depth = VFloat::load(&_depth[offset]);
+                    VFloat w_depth = abs(centerDepth - depth) * (1.0f / (sqrtf((float)(kx * kx + ky * ky)) + 0.001f));
+                    VFloat w_luma = abs(luma - centerLuma) * rcpLumaPhi;
+
+                    VFloat w = csel(sampleMask, ExpNeg(w_luma + w_depth), 0.0f);
+
+                    sumIrradiance += irradiance * w;
+                    sumMoments.x += luma * w;
+                    sumMoments.y += luma * luma * w;
+                    wsum += w;
+                }
+            }
+            VFloat rcpWeight = 1.0f / max(wsum, 0.001f);
+            sumIrradiance *= rcpWeight;
+            sumMoments.x *= rcpWeight;
+            sumMoments.y *= rcpWeight;
+
+            VFloat variance = max(sumMoments.y - sumMoments.x * sumMoments.x, 0.0f);
+            variance *= (4.0f - historyLen) * 3.0f;
+
+            center.x = csel(estimMask, sumIrradiance.x, center.x);
+            center.y = csel(estimMask, sumIrradiance.y, center.y);
+            center.z = csel(estimMask, sumIrradiance.z, center.z);
+            center.w = csel(estimMask, variance, center.w);
+        }
+        center.x.store(&GetRow(dest[0], y)[x]);
+        center.y.store(&GetRow(dest[1], y)[x]);
+        center.z.store(&GetRow(dest[2], y)[x]);
+        center.w.store(&GetRow(dest[3], y)[x]);
+    }
+}
+
+// Edge-avoiding a-trous wavelet filter, see svgfAtrous() in Filter.comp
+void CpuDenoiser::FilterAtrous(uint32_t y, uint32_t passNo, const IrradianceBuffer& src, IrradianceBuffer& dest) {
+    const float* depthRow = GetRow(_depth, y);
+    const int32_t* normalRow = GetRow(_normals, y);
+
+    const int32_t r = 2;
+    const float kernel[] = { 3.0f / 8, 1.0f / 4, 1.0f / 16 };
+    const float varianceKernel[2][2] = {
+        { 1.0f / 4, 1.0f / 8 },
+        { 1.0f / 8, 1.0f / 16 },
+    };
+
+    for (uint32_t x = 0; x < _size.x; x += simd::VectorWidth) {
+        VInt xs = (int32_t)x + simd::LaneIdx;
+        VFloat centerDepth = VFloat::load(&depthRow[x]);
+
+        VFloat4 center = {
+            VFloat::load(&GetRow(src[0], y)[x]),
+            VFloat::load(&GetRow(src[1], y)[x]),
+            VFloat::load(&GetRow(src[2], y)[x]),
+            VFloat::load(&GetRow(src[3], y)[x]),
+        };
+        VMask filterMask = centerDepth >= 0.0f;
+
+        if (any(filterMask)) {
+            // 3x3 blurred variance, out of bounds taps are zero like with imageLoad()
+            VFloat centerVariance = 0.0f;
+
+            for (int32_t ky = -1; ky <= 1; ky++) {
+                uint32_t sy = y + ky;
+                if (sy >= _size.y) continue;
+
+                for (int32_t kx = -1; kx <= 1; kx++) {
+                    VFloat variance = VFloat::load(&src[3][sy * _stride + PadX + x + kx]);
+                    VMask sampleMask = simd::ucmp_lt(xs + kx, (int32_t)_size.x);
+                    centerVariance += csel(sampleMask, variance, 0.0f) * varianceKernel[std::abs(kx)][std::abs(ky)];
+                }
+            }
+            VInt centerNormalId = VInt::load(&normalRow[x]);
+            VFloat centerLuma = GetLuminance(center.x, center.y, center.z);
+            VFloat rcpLumaPhi = 1.0f / (sqrt(max(centerVariance, 0.0001f)) * 4.0f);
+
+            VFloat4 sumIrradiance = center;
+            VFloat wsum = 1.0f;
+
+            for (int32_t ky = -r; ky <= r; ky++) {
+                uint32_t sy = y + (ky * (1 << passNo));
+                if (sy >= _size.y) continue;
+
+                for (int32_t kx = -r; kx <= r; kx++) {
+                    if (kx == 0 && ky == 0) continue;
+
+                    int32_t dx = kx * (1 << passNo);
+                    uint32_t offset = sy * _stride + PadX + x + dx;
+                    VMask sampleMask = simd::ucmp_lt(xs + dx, (int32_t)_size.x);
+
+                    VFloat4 irradiance = { VFloat::load(&src[0][offset]), VFloat::load(&src[1][offset]), VFloat::load(&src[2][offset]),
+                                           VFloat::load(&src[3][offset]) };
+                    VFloat luma = GetLuminance(irradiance.x, irradiance.y, irradiance.z);
+                    sampleMask &= VInt::load(&_normals[offset]) == centerNormalId;
+
+                    // FIXME: this won't do anything, depth should be linear
+                    float dist = sqrtf((float)(kx * kx + ky * ky)) * (float)(1 << passNo);
+                    VFloat depth = VFloat::load(&_depth[offset]);
+                    VFloat w_depth = abs(centerDepth - depth) * (1.0f / (dist + 0.001f));
+                    VFloat w_luma = abs(luma - centerLuma) * rcpLumaPhi;
+
+                    VFloat w = ExpNeg(w_luma + w_depth) * (kernel[std::abs(kx)] * kernel[std::abs(ky)]);
+                    w = csel(sampleMask, w, 0.0f);
+
+                    sumIrradiance.x += irradiance.x * w;
+                    sumIrradiance.y += irradiance.y * w;
+                    sumIrradiance.z += irradiance.z * w;
+                    sumIrradiance.w += irradiance.w * (w * w);
+                    wsum += w;
+                }
+            }
+            VFloat rcpWeight = 1.0f / max(wsum, 0.001f);
+
+            center.x = csel(filterMask, sumIrradiance.x * rcpWeight, center.x);
+            center.y = csel(filterMask, sumIrradiance.y * rcpWeight, center.y);
+            center.z = csel(filterMask, sumIrradiance.z * rcpWeight, center.z);
+            center.w = csel(filterMask, sumIrradiance.w * (rcpWeight * rcpWeight), center.w);
+        }
+        center.x.store(&GetRow(dest[0], y)[x]);
+        center.y.store(&GetRow(dest[1], y)[x]);
+        center.z.store(&GetRow(dest[2], y)[x]);
+        center.w.store(&GetRow(dest[3], y)[x]);
+    }
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <array>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <Common/ThreadPool.h>
+
+struct Framebuffer;
+
+// CPU port of the SVGF denoiser in Shaders/Denoise/, for rendering without a GPU.
+// History is kept in row-major planar buffers, and the filtered irradiance is written back into the tiled framebuffer.
+struct CpuDenoiser {
+    static constexpr uint32_t MaxPasses = 5;
+
+    uint32_t NumPasses = 5;  // Number of a-trous passes, 0 only does temporal accumulation.
+
+    // Denoises the irradiance of the given frame in place.
+    // `proj` and `viewPos` must be the same used to render the frame. `resetHistory` shortens history after world changes.
+    void Denoise(Framebuffer& fb, const glm::mat4& proj, glm::dvec3 viewPos, bool resetHistory, glim::ThreadPool& threadPool);
+
+private:
+    using IrradianceBuffer = std::array<std::vector<float>, 4>;  // RGB + variance
+
+    // Rows are padded on both sides, so that neighbor loads don't need to be clamped.
+    static const uint32_t PadX = 64;
+
+    glm::uvec2 _size = glm::uvec2(0);
+    uint32_t _stride = 0;
+
+    glm::mat4 _currentProj = glm::mat4(1.0f), _historyProj = glm::mat4(1.0f);
+    glm::dvec3 _currentPos = glm::dvec3(0.0), _historyPos = glm::dvec3(0.0);
+
+    // Screen space inverse projections and origin delta for the current frame
+    glm::mat4 _invProj, _historyInvProj;
+    glm::vec3 _originDelta;
+
+    std::vector<int32_t> _normals, _prevNormals;  // Packed normal from albedo alpha
+    std::vector<float> _depth, _prevDepth;
+    std::array<std::vector<float>, 2> _moments, _prevMoments;
+    std::vector<float> _historyLen, _prevHistoryLen;
+
+    IrradianceBuffer _irradiance, _history;
+    IrradianceBuffer _filterTemp[2];
+
+    void Resize(glm::uvec2 size);
+
+    void LoadTiles(const Framebuffer& fb, uint32_t tileY);
+    void StoreTiles(Framebuffer& fb, uint32_t tileY, const IrradianceBuffer& src);
+
+    void Reproject(uint32_t y, bool resetHistory);
+    void EstimateVariance(uint32_t y, IrradianceBuffer& dest);
+    void FilterAtrous(uint32_t y, uint32_t passNo, const IrradianceBuffer& src, IrradianceBuffer& dest);
+
+    template<typename T>
+    T* GetRow(std::vector<T>& plane, uint32_t y) { return &plane[y * _stride + PadX]; }
+    template<typename T>
+    const T* GetRow(const std::vector<T>& plane, uint32_t y) const { return &plane[y * _stride + PadX]; }
+};
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <SwRast/SIMD.h>
+
+// Framebuffer written by the CPU renderer, in SIMD tiles of `TileWidth x TileHeight` pixels.
+// Layout must match CopyTiledFramebuffer.comp.
+struct Framebuffer {
+    struct alignas(64) Tile {
+        VInt Albedo;        // RGBA8, A = normal
+        VFloat Depth;
+        VInt IrradianceRG;  // F16
+        VInt IrradianceBX;  // F16, u16 unused
+    };
+    uint32_t Width, Height, TileStride;
+    uint32_t TileShiftX, TileShiftY;
+    Tile Tiles[];
+};
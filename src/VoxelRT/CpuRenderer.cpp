@@ -1,13 +1,20 @@
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cmath>
 #include <cstdint>
-#include <execution>
 #include <memory>
-#include <ranges>
+#include <unordered_set>
 
+#include <Common/VirtualMemory.h>
 #include <SwRast/SIMD.h>
 #include <SwRast/Texture.h>
 
 #include "Renderer.h"
 
+#include "CpuDenoiser.h"
+#include "CpuFramebuffer.h"
 #include "GBuffer.h"
 
 // Cannot be > 2048*512*2048 because memory index is signed 32-bits
@@ -15,71 +22,160 @@ using ViewSectorIndexer =
     LinearIndexer3D<11 - MaskIndexer::ShiftXZ - BrickIndexer::ShiftXZ,
                     9 - MaskIndexer::ShiftY - BrickIndexer::ShiftY, false>;
 
-using BrickMaskIndexer = LinearIndexer3D<BrickIndexer::ShiftXZ - 2, BrickIndexer::ShiftY - 2, false>;
+static const uint32_t SectorVoxelShiftXZ = MaskIndexer::ShiftXZ + BrickIndexer::ShiftXZ;
+static const uint32_t SectorVoxelShiftY = MaskIndexer::ShiftY + BrickIndexer::ShiftY;
+
+// Groups of 4x4x4 sectors, for skipping over empty space at a coarser level than SectorMasks.
+using SectorGroupIndexer = LinearIndexer3D<ViewSectorIndexer::ShiftXZ - MaskIndexer::ShiftXZ, ViewSectorIndexer::ShiftY - MaskIndexer::ShiftY, false>;
+
+static const uint32_t GroupVoxelShiftXZ = SectorVoxelShiftXZ + MaskIndexer::ShiftXZ;
+static const uint32_t GroupVoxelShiftY = SectorVoxelShiftY + MaskIndexer::ShiftY;
 
+// Toroidal window of world sectors around the camera. World sector positions are mapped
+// to storage slots modulo the window size, so that only sectors entering the window need
+// to be uploaded when it moves.
 struct FlatVoxelStorage {
-    std::unique_ptr<uint8_t[]> StorageBuffer;
-    std::unique_ptr<uint64_t[]> OccupancyStorage;
-    uint64_t SectorMasks[ViewSectorIndexer::MaxArea] = {};
+    static const size_t SectorStorageSize = sizeof(Brick) * MaskIndexer::MaxArea;
+    static const size_t SectorOccupancySize = SectorStorageSize / 8;
+    static const int32_t MaxWindowDrift = 4;  // Number of sectors the camera can move away from the window center before it is recentered
+
+    // Address space is only reserved up front, and sector ranges are committed when they are first populated.
+    glim::VirtualBuffer StorageBuffer { ViewSectorIndexer::MaxArea * SectorStorageSize };
+    glim::VirtualBuffer OccupancyStorage { ViewSectorIndexer::MaxArea * SectorOccupancySize };
+    uint64_t SectorMasks[ViewSectorIndexer::MaxArea] = {};  // Sector is committed iff mask != 0
+    uint64_t SectorGroupMasks[SectorGroupIndexer::MaxArea] = {};  // Bit set iff SectorMasks[] != 0
     uint64_t Palette[256];
+    alignas(64) uint32_t PackedPalette[256];  // Low halves of Palette[], which is all that traversal needs
+    std::atomic_uint32_t NumCommittedSectors = 0;
 
-    FlatVoxelStorage() {
-        size_t storageCap = ViewSectorIndexer::MaxArea * (MaskIndexer::MaxArea * BrickIndexer::MaxArea);
-        // TODO: implement sparse memory alloc using VirtualAlloc? page remapping could also be useful for something
-        StorageBuffer = std::make_unique<uint8_t[]>(storageCap);
-        OccupancyStorage = std::make_unique<uint64_t[]>(storageCap / 64);
+    glm::ivec3 WindowPos = glm::ivec3(1 << 30);  // Min sector pos covered by the window. Initially far away from anything.
+
+    bool IsInWindow(glm::ivec3 sectorPos) const {
+        return ViewSectorIndexer::CheckInBounds(sectorPos - WindowPos);
+    }
+    glm::ivec3 GetWindowMinVoxelPos() const {
+        return WindowPos << glm::ivec3(SectorVoxelShiftXZ, SectorVoxelShiftY, SectorVoxelShiftXZ);
+    }
+    static glm::ivec3 GetWindowSizeInVoxels() {
+        return ViewSectorIndexer::Size << glm::ivec3(SectorVoxelShiftXZ, SectorVoxelShiftY, SectorVoxelShiftXZ);
     }
 
-    void SyncBuffers(VoxelMap& map) {
+    // Returns the number of uploaded bricks.
+    uint32_t SyncBuffers(VoxelMap& map, glm::dvec3 viewPos, glim::ThreadPool& threadPool) {
         for (uint32_t i = 0; i < 256; i++) {
             Palette[i] = map.Palette[i].GetEncoded();
+            PackedPalette[i] = (uint32_t)Palette[i];
+        }
+        std::vector<std::pair<uint32_t, uint64_t>> pendingSectors;
+
+        glm::ivec3 viewSectorPos = glm::ivec3(glm::floor(viewPos)) >> glm::ivec3(SectorVoxelShiftXZ, SectorVoxelShiftY, SectorVoxelShiftXZ);
+        glm::ivec3 drift = glm::abs(viewSectorPos - (WindowPos + ViewSectorIndexer::Size / 2));
+
+        if (glm::any(glm::greaterThan(drift, glm::ivec3(MaxWindowDrift)))) {
+            MoveWindow(map, viewSectorPos - ViewSectorIndexer::Size / 2, pendingSectors);
         }
 
         for (auto [sectorIdx, dirtyMask] : map.DirtyLocs) {
             glm::ivec3 sectorPos = WorldSectorIndexer::GetPos(sectorIdx);
-            if (!ViewSectorIndexer::CheckInBounds(sectorPos)) continue;
+            if (!IsInWindow(sectorPos)) continue;
 
-            uint32_t sectorViewIdx = ViewSectorIndexer::GetIndex(sectorPos);
-            if (!map.Sectors.contains(sectorIdx)) {
-                SectorMasks[sectorViewIdx] = 0;
-                continue;
-            }
+            pendingSectors.push_back({ sectorIdx, dirtyMask });
+        }
+        map.DirtyLocs.clear();
+
+        // Sectors map to distinct storage slots, so they can be synced independently.
+        // DirtyLocs is in Morton order, so each worker gets a spatially coherent range.
+        std::atomic_uint32_t numSyncedBricks = 0;
+
+        threadPool.ParallelFor((uint32_t)pendingSectors.size(), [&](uint32_t i, uint32_t workerIdx) {
+            auto [sectorIdx, dirtyMask] = pendingSectors[i];
+            numSyncedBricks.fetch_add(SyncSector(map, sectorIdx, dirtyMask), std::memory_order_relaxed);
+        });
+        return numSyncedBricks;
+    }
 
-            Sector& sector = map.Sectors[sectorIdx];
-            uint64_t allocMask = sector.GetAllocationMask();
-            SectorMasks[sectorViewIdx] = allocMask;
+private:
+    void MoveWindow(VoxelMap& map, glm::ivec3 newPos, std::vector<std::pair<uint32_t, uint64_t>>& pendingSectors) {
+        glm::ivec3 oldPos = WindowPos;
+        WindowPos = newPos;
 
-            for (uint32_t brickIdx : BitIter(dirtyMask & allocMask)) {
-                uint32_t storageOffset = sectorViewIdx * (sizeof(Brick) * 64) + brickIdx * sizeof(Brick);
+        // Evict sectors that left the window
+        for (uint32_t i = 0; i < ViewSectorIndexer::MaxArea; i++) {
+            if (SectorMasks[i] == 0) continue;
 
-                Brick* brick = sector.GetBrick(brickIdx);
-                std::memcpy(&StorageBuffer[storageOffset], brick, sizeof(Brick));
-                UpdateOccupancy(brick, storageOffset / 64);
+            glm::ivec3 sectorPos = oldPos + ((ViewSectorIndexer::GetPos(i) - oldPos) & (ViewSectorIndexer::Size - 1));
+            if (!IsInWindow(sectorPos)) {
+                EvictSector(i);
             }
         }
-        map.DirtyLocs.clear();
+
+        // Upload sectors that entered it. Dirty bricks of sectors that were already inside will be added by the caller.
+        for (auto& [sectorIdx, sector] : map.Sectors) {
+            glm::ivec3 sectorPos = WorldSectorIndexer::GetPos(sectorIdx);
+            if (!IsInWindow(sectorPos) || ViewSectorIndexer::CheckInBounds(sectorPos - oldPos)) continue;
+
+            pendingSectors.push_back({ sectorIdx, ~0ull });
+            map.DirtyLocs.erase(sectorIdx);
+        }
     }
 
-    void UpdateOccupancy(Brick* brick, uint32_t storageOffset) {
-        const uint32_t BrickSize = BrickIndexer::SizeXZ;
+    uint32_t SyncSector(VoxelMap& map, uint32_t sectorIdx, uint64_t dirtyMask) {
+        uint32_t sectorViewIdx = ViewSectorIndexer::GetIndex(WorldSectorIndexer::GetPos(sectorIdx));
+        auto iter = map.Sectors.find(sectorIdx);
+        uint64_t allocMask = iter != map.Sectors.end() ? iter->second.GetAllocationMask() : 0;
+
+        if (allocMask == 0) {
+            EvictSector(sectorViewIdx);
+            return 0;
+        }
+        if (SectorMasks[sectorViewIdx] == 0) {
+            StorageBuffer.Commit(sectorViewIdx * SectorStorageSize, SectorStorageSize);
+            OccupancyStorage.Commit(sectorViewIdx * SectorOccupancySize, SectorOccupancySize);
+            NumCommittedSectors++;
+            SetGroupBit(sectorViewIdx, true);
+        }
+        const Sector& sector = iter->second;
+        SectorMasks[sectorViewIdx] = allocMask;
+        uint32_t numSyncedBricks = 0;
 
-        uint64_t* cells = &OccupancyStorage[storageOffset];
+        for (uint32_t brickIdx : BitIter(dirtyMask & allocMask)) {
+            uint32_t storageOffset = sectorViewIdx * SectorStorageSize + brickIdx * sizeof(Brick);
 
-        // clang-format off
-        for (uint32_t cy = 0; cy < BrickSize; cy += 4)
-        for (uint32_t cz = 0; cz < BrickSize; cz += 4)
-        for (uint32_t cx = 0; cx < BrickSize; cx += 4) {
-            uint64_t mask = 0;
+            const Brick* brick = sector.GetBrick(brickIdx);
+            std::memcpy(&StorageBuffer.Data()[storageOffset], brick, sizeof(Brick));
 
-            for (uint32_t vy = 0; vy < 4; vy++)
-            for (uint32_t vz = 0; vz < 4; vz++)
-            for (uint32_t vx = 0; vx < 4; vx++) {
-                bool occupied = !brick->Data[BrickIndexer::GetIndex(cx + vx, cy + vy, cz + vz)].IsEmpty();
-                mask |= uint64_t(occupied) << (vx + vz * 4 + vy * 16);
+            auto& occupancy = *(BrickOccupancy*)&OccupancyStorage.Data()[storageOffset / 8];
+            if (auto cached = sector.GetCachedOccupancy(brickIdx)) {
+                occupancy = *cached;
+            } else {
+                brick->ComputeOccupancy(occupancy);
             }
-            cells[BrickMaskIndexer::GetIndex(glm::uvec3(cx, cy, cz) / 4u)] = mask;
+            numSyncedBricks++;
+        }
+        return numSyncedBricks;
+    }
+
+    void EvictSector(uint32_t sectorViewIdx) {
+        if (SectorMasks[sectorViewIdx] == 0) return;
+
+        StorageBuffer.Decommit(sectorViewIdx * SectorStorageSize, SectorStorageSize);
+        OccupancyStorage.Decommit(sectorViewIdx * SectorOccupancySize, SectorOccupancySize);
+        SectorMasks[sectorViewIdx] = 0;
+        NumCommittedSectors--;
+        SetGroupBit(sectorViewIdx, false);
+    }
+
+    // Sectors are synced in parallel, and neighbors may share the same group mask.
+    void SetGroupBit(uint32_t sectorViewIdx, bool occupied) {
+        glm::ivec3 slotPos = ViewSectorIndexer::GetPos(sectorViewIdx);
+        auto groupMask = std::atomic_ref(SectorGroupMasks[SectorGroupIndexer::GetIndex(slotPos >> MaskIndexer::Shift)]);
+        uint64_t bit = 1ull << MaskIndexer::GetIndex(slotPos);
+
+        if (occupied) {
+            groupMask.fetch_or(bit, std::memory_order_relaxed);
+        } else {
+            groupMask.fetch_and(~bit, std::memory_order_relaxed);
         }
-        // clang-format on
     }
 };
 
@@ -93,6 +189,8 @@ struct VHitResult {
     VFloat2 UV;
 
     VMask Mask;
+    uint32_t NumIters;  // Sum of active lanes over all traversal iterations
+    uint32_t NumSteps;  // Number of traversal iterations, NumIters / (NumSteps * VectorWidth) = lane utilization
 
     VFloat3 GetColor() const {
         VFloat3 color = {
@@ -107,15 +205,41 @@ struct VHitResult {
     }
 };
 
-static const uint32_t SectorVoxelShiftXZ = MaskIndexer::ShiftXZ + BrickIndexer::ShiftXZ;
-static const uint32_t SectorVoxelShiftY = MaskIndexer::ShiftY + BrickIndexer::ShiftY;
+// Creates mask for voxel coords that are inside the storage window.
+static VMask GetInboundMask(const FlatVoxelStorage& map, VInt x, VInt y, VInt z) {
+    glm::ivec3 windowMin = map.GetWindowMinVoxelPos();
+    x -= windowMin.x;
+    y -= windowMin.y;
+    z -= windowMin.z;
 
-// Creates mask for voxel coords that are inside the brick map.
-static VMask GetInboundMask(VInt x, VInt y, VInt z) {
     return simd::ucmp_lt(x | z, ViewSectorIndexer::SizeXZ << SectorVoxelShiftXZ) &
            simd::ucmp_lt(y, ViewSectorIndexer::SizeY << SectorVoxelShiftY);
 }
 
+// Returns PackedPalette[voxelIds] for lanes in `mask`, and 0 for others.
+static VInt GetPaletteData(const FlatVoxelStorage& map, VInt voxelIds, VMask mask) {
+#if SIMD_AVX512
+    // The whole palette fits in 16 registers. 8 two-table permutes and a select tree over
+    // the upper index bits are cheaper than a 16-lane gather.
+    const __m512i* table = (const __m512i*)map.PackedPalette;
+    __m512i parts[8];
+
+    for (uint32_t i = 0; i < 8; i++) {
+        parts[i] = _mm512_permutex2var_epi32(_mm512_load_si512(&table[i * 2 + 0]), voxelIds, _mm512_load_si512(&table[i * 2 + 1]));
+    }
+    for (uint32_t bit = 5, n = 8; n > 1; bit++, n /= 2) {
+        __mmask16 upperMask = _mm512_test_epi32_mask(voxelIds, _mm512_set1_epi32(1 << bit));
+
+        for (uint32_t i = 0; i < n / 2; i++) {
+            parts[i] = _mm512_mask_blend_epi32(upperMask, parts[i * 2 + 0], parts[i * 2 + 1]);
+        }
+    }
+    return _mm512_maskz_mov_epi32(mask, parts[0]);
+#else  // SIMD_AVX2
+    return VInt::mask_gather<4>(map.PackedPalette, voxelIds, mask);
+#endif
+}
+
 // 2 dependent gathers: >=50 latency + index calc
 static VInt GetVoxelMaterial(const FlatVoxelStorage& map, VInt3 pos, VMask mask) {
     VInt sectorIdx = ViewSectorIndexer::GetIndex(pos.x >> SectorVoxelShiftXZ, pos.y >> SectorVoxelShiftY, pos.z >> SectorVoxelShiftXZ);
@@ -125,23 +249,76 @@ static VInt GetVoxelMaterial(const FlatVoxelStorage& map, VInt3 pos, VMask mask)
     VInt slotIdx = sectorIdx * (sizeof(Brick) * 64) + maskIdx * sizeof(Brick) + voxelIdx;
 
     // Do 4-aligned gather to avoid crossing cache/pages
-    VInt voxelIds = VInt::mask_gather<4>(map.StorageBuffer.get(), slotIdx >> 2, mask);
+    VInt voxelIds = VInt::mask_gather<4>(map.StorageBuffer.Data(), slotIdx >> 2, mask);
     voxelIds = voxelIds >> ((slotIdx & 3) * 8) & 255;
 
-    return VInt::mask_gather<8>(map.Palette, voxelIds, mask);
+    return GetPaletteData(map, voxelIds, mask);
 }
 
+struct TraversalSettings {
+    bool AnisotropicLods;  // Filter occupancy masks by ray octant before picking step LOD
+
+    // Stop refining to single voxels after this many iterations or voxels of distance,
+    // and take any occupied voxel in the 4x4x4 cell instead. 0 = always exact.
+    uint32_t CoarseThreshold = 0;
+
+    // Reuse sector and cell masks gathered on previous steps, and prefetch occupancy of the next brick.
+    bool CacheStepMasks = false;
+};
+
+// Masks gathered by previous traversal steps, per lane. Rays often take several steps within the same
+// sector or 4x4x4 cell, and those only need to gather for lanes that moved to a different one.
+// Entries are keyed by storage index, so they stay valid when lanes are refilled with new rays.
+struct StepMaskCache {
+    VInt SectorIdx = -1, SectorMask_0, SectorMask_32;
+    VInt CellIdx = -1, CellMask_0, CellMask_32;
+};
+
+struct RayCellMaskLUT {
+    uint64_t Data[64 * 8];
+
+    RayCellMaskLUT() { GenerateRayCellInteractionMaskLUT(Data); }
+};
+static const RayCellMaskLUT _rayCellMaskLUT;
+
 // 2/4 independet gathers: >=30/60 latency + ALU
-static VMask GetStepPos(const FlatVoxelStorage& map, VInt3& pos, VFloat3 dir, VMask mask) {
+static VMask GetStepPos(const FlatVoxelStorage& map, VInt3& pos, VFloat3 dir, VMask mask, VMask coarseMask,
+                        const TraversalSettings& settings, StepMaskCache& cache) {
     VInt sectorIdx = ViewSectorIndexer::GetIndex(pos.x >> SectorVoxelShiftXZ, pos.y >> SectorVoxelShiftY, pos.z >> SectorVoxelShiftXZ);
+    VInt mask_0, mask_32;
 
-    VInt mask_0 = VInt::mask_gather<8>((uint8_t*)map.SectorMasks + 0, sectorIdx, mask);
-    VInt mask_32 = VInt::mask_gather<8>((uint8_t*)map.SectorMasks + 4, sectorIdx, mask);
+    if (settings.CacheStepMasks) {
+        VMask missMask = mask & (sectorIdx != cache.SectorIdx);
+
+        if (simd::any(missMask)) {
+            cache.SectorMask_0.set_if(missMask, VInt::mask_gather<8>((uint8_t*)map.SectorMasks + 0, sectorIdx, missMask));
+            cache.SectorMask_32.set_if(missMask, VInt::mask_gather<8>((uint8_t*)map.SectorMasks + 4, sectorIdx, missMask));
+            cache.SectorIdx.set_if(missMask, sectorIdx);
+        }
+        // Inactive lanes must see empty masks, like with masked gathers
+        mask_0 = csel(mask, cache.SectorMask_0, VInt(0));
+        mask_32 = csel(mask, cache.SectorMask_32, VInt(0));
+    } else {
+        mask_0 = VInt::mask_gather<8>((uint8_t*)map.SectorMasks + 0, sectorIdx, mask);
+        mask_32 = VInt::mask_gather<8>((uint8_t*)map.SectorMasks + 4, sectorIdx, mask);
+    }
 
     VInt maskIdx = MaskIndexer::GetIndex(pos.x >> BrickIndexer::ShiftXZ, pos.y >> BrickIndexer::ShiftY, pos.z >> BrickIndexer::ShiftXZ);
+    VInt lod = 3;
+
+    // Sector is empty, step over sectors in the group instead
+    VMask sectorEmpty = mask & ((mask_0 | mask_32) == 0);
+    if (simd::any(sectorEmpty)) {
+        VInt groupIdx = SectorGroupIndexer::GetIndex(pos.x >> GroupVoxelShiftXZ, pos.y >> GroupVoxelShiftY, pos.z >> GroupVoxelShiftXZ);
+
+        maskIdx.set_if(sectorEmpty, MaskIndexer::GetIndex(pos.x >> SectorVoxelShiftXZ, pos.y >> SectorVoxelShiftY, pos.z >> SectorVoxelShiftXZ));
+        lod.set_if(sectorEmpty, SectorVoxelShiftXZ);
+
+        mask_0.set_if(sectorEmpty, VInt::mask_gather<8>((uint8_t*)map.SectorGroupMasks + 0, groupIdx, sectorEmpty));
+        mask_32.set_if(sectorEmpty, VInt::mask_gather<8>((uint8_t*)map.SectorGroupMasks + 4, groupIdx, sectorEmpty));
+    }
     VInt currMask = csel(maskIdx < 32, mask_0, mask_32);
     VMask level0 = (currMask >> (maskIdx & 31) & 1) != 0;
-    VInt lod = 3;
 
     if (simd::any(level0)) {
         VInt cellIdx = (sectorIdx * (sizeof(Brick) * 64) + maskIdx * sizeof(Brick)) >> 6;
@@ -150,15 +327,38 @@ static VMask GetStepPos(const FlatVoxelStorage& map, VInt3& pos, VFloat3 dir, VM
         maskIdx.set_if(level0, MaskIndexer::GetIndex(pos.x, pos.y, pos.z));
         lod.set_if(level0, 0);
 
-        mask_0.set_if(level0, VInt::mask_gather<8>((uint8_t*)map.OccupancyStorage.get() + 0, cellIdx, mask & level0));
-        mask_32.set_if(level0, VInt::mask_gather<8>((uint8_t*)map.OccupancyStorage.get() + 4, cellIdx, mask & level0));
+        if (settings.CacheStepMasks) {
+            VMask missMask = mask & level0 & (cellIdx != cache.CellIdx);
+
+            if (simd::any(missMask)) {
+                cache.CellMask_0.set_if(missMask, VInt::mask_gather<8>((uint8_t*)map.OccupancyStorage.Data() + 0, cellIdx, missMask));
+                cache.CellMask_32.set_if(missMask, VInt::mask_gather<8>((uint8_t*)map.OccupancyStorage.Data() + 4, cellIdx, missMask));
+                cache.CellIdx.set_if(missMask, cellIdx);
+            }
+            mask_0.set_if(level0, cache.CellMask_0);
+            mask_32.set_if(level0, cache.CellMask_32);
+        } else {
+            mask_0.set_if(level0, VInt::mask_gather<8>((uint8_t*)map.OccupancyStorage.Data() + 0, cellIdx, mask & level0));
+            mask_32.set_if(level0, VInt::mask_gather<8>((uint8_t*)map.OccupancyStorage.Data() + 4, cellIdx, mask & level0));
+        }
 
         currMask = csel(maskIdx < 32, mask_0, mask_32);
         level0 = (currMask >> (maskIdx & 31) & 1) != 0;
     }
 
+    // Ignore cells behind the ray, so that it can take bigger steps
+    if (settings.AnisotropicLods) {
+        VInt octant = csel(dir.x < 0, VInt(0), 1) + csel(dir.y < 0, VInt(0), 2) + csel(dir.z < 0, VInt(0), 4);
+        VInt lutIdx = maskIdx + octant * 64;
+
+        mask_0 &= VInt::mask_gather<8>((uint8_t*)_rayCellMaskLUT.Data + 0, lutIdx, mask);
+        mask_32 &= VInt::mask_gather<8>((uint8_t*)_rayCellMaskLUT.Data + 4, lutIdx, mask);
+        currMask = csel(maskIdx < 32, mask_0, mask_32);
+    }
+
     VMask level4 = (mask_0 | mask_32) == 0;
     VMask level2 = (currMask >> (maskIdx & 0xA) & 0x00330033) == 0;
+    VMask coarseHit = coarseMask & ~level0 & ~level4 & (lod == 0);
     lod += csel(level4, 2, csel(level2, 1, VInt(0)));
 
     VInt cellMask = (1 << lod) - 1;
@@ -167,60 +367,188 @@ static VMask GetStepPos(const FlatVoxelStorage& map, VInt3& pos, VFloat3 dir, VM
     pos.y.set_if(mask, csel(dir.y < 0, (pos.y & ~cellMask), (pos.y | cellMask)));
     pos.z.set_if(mask, csel(dir.z < 0, (pos.z & ~cellMask), (pos.z | cellMask)));
 
+    // Coarse rays hit the first occupied voxel in the cell, which may not be on the ray.
+    if (simd::any(coarseHit)) {
+        VInt firstIdx = csel(mask_0 != 0, simd::tzcnt(mask_0), simd::tzcnt(mask_32) + 32);
+
+        pos.x.set_if(coarseHit, (pos.x & ~3) | (firstIdx & 3));
+        pos.y.set_if(coarseHit, (pos.y & ~3) | (firstIdx >> 4 & 3));
+        pos.z.set_if(coarseHit, (pos.z & ~3) | (firstIdx >> 2 & 3));
+        level0 |= coarseHit;
+    }
     return level0;
 }
-static VHitResult RayCast(const FlatVoxelStorage& map, VFloat3 origin, VFloat3 dir, VMask activeMask, glm::ivec3 worldOrigin) {
-    VFloat3 invDir = 1.0f / dir;
-    // VFloat3 tStart = (max(sign(dir), 0.0) - origin) * invDir;
-    VFloat3 tStart = {
-        (csel(dir.x < 0, VFloat(0.0), 1.0f) - origin.x) * invDir.x,
-        (csel(dir.y < 0, VFloat(0.0), 1.0f) - origin.y) * invDir.y,
-        (csel(dir.z < 0, VFloat(0.0), 1.0f) - origin.z) * invDir.z,
-    };
-    VFloat3 sideDist = 0.0f;
-    VFloat3 currPos = origin;
-    VInt3 voxelPos;
-    VMask inboundMask = 0;
 
-    for (uint32_t i = 0; i < 128; i++) {
-        voxelPos = worldOrigin + VInt3(floor2i(currPos.x), floor2i(currPos.y), floor2i(currPos.z));
+// Prefetches occupancy of the brick that lanes will step into, if it is different from the last one they
+// gathered and known to be occupied by the cached sector mask. Otherwise it is either cached or not needed.
+static void PrefetchNextBricks(const FlatVoxelStorage& map, VInt3 pos, VMask mask, const StepMaskCache& cache) {
+    VInt sectorIdx = ViewSectorIndexer::GetIndex(pos.x >> SectorVoxelShiftXZ, pos.y >> SectorVoxelShiftY, pos.z >> SectorVoxelShiftXZ);
+    VInt maskIdx = MaskIndexer::GetIndex(pos.x >> BrickIndexer::ShiftXZ, pos.y >> BrickIndexer::ShiftY, pos.z >> BrickIndexer::ShiftXZ);
+    VInt cellBaseIdx = (sectorIdx * (sizeof(Brick) * 64) + maskIdx * sizeof(Brick)) >> 6;
+
+    VInt sectorMask = csel(maskIdx < 32, cache.SectorMask_0, cache.SectorMask_32);
+    mask &= (sectorIdx == cache.SectorIdx) & ((sectorMask >> (maskIdx & 31) & 1) != 0);
+    mask &= cellBaseIdx != (cache.CellIdx & ~(int32_t)(BrickMaskIndexer::MaxArea - 1));
+
+    for (uint32_t lane : BitIter<uint32_t>(mask)) {
+        _mm_prefetch((const char*)map.OccupancyStorage.Data() + (size_t)cellBaseIdx[lane] * 8, _MM_HINT_T0);
+    }
+}
+
+static const uint32_t MaxTraversalIters = 128;
+
+static void SetLanes(VMask mask, VFloat3& dest, const VFloat3& src) {
+    dest.x.set_if(mask, src.x);
+    dest.y.set_if(mask, src.y);
+    dest.z.set_if(mask, src.z);
+}
+
+// Traversal state of a ray packet. Lanes are started independently, so that RayCastQueue()
+// can refill terminated lanes with new rays while the others keep going.
+struct RayTraversal {
+    VFloat3 Origin, Dir, InvDir, TStart;
+    VFloat3 SideDist, CurrPos;
+    VFloat CurrDist;
+    VInt3 VoxelPos;  // Only valid for lanes that hit
+    StepMaskCache MaskCache;
+
+    // Starts traversing new rays in the lanes set in `mask`, from `startDist` which must be before any surface along the ray.
+    // Returns the started lanes that intersect the storage window.
+    VMask Begin(const FlatVoxelStorage& map, VMask mask, VFloat3 origin, VFloat3 dir, glm::ivec3 worldOrigin, VFloat startDist) {
+        VFloat3 invDir = 1.0f / dir;
+        SetLanes(mask, Origin, origin);
+        SetLanes(mask, Dir, dir);
+        SetLanes(mask, InvDir, invDir);
+        // tStart = (max(sign(dir), 0.0) - origin) * invDir;
+        SetLanes(mask, TStart, {
+            (csel(dir.x < 0, VFloat(0.0), 1.0f) - origin.x) * invDir.x,
+            (csel(dir.y < 0, VFloat(0.0), 1.0f) - origin.y) * invDir.y,
+            (csel(dir.z < 0, VFloat(0.0), 1.0f) - origin.z) * invDir.z,
+        });
+        SetLanes(mask, SideDist, 0.0f);
+        SetLanes(mask, CurrPos, origin);
+        CurrDist.set_if(mask, 0.0f);
+
+        // Clip rays to the storage window, so they don't waste iterations getting to it
+        glm::vec3 boxMin = glm::vec3(map.GetWindowMinVoxelPos() - worldOrigin) + 1.0f;
+        glm::vec3 boxMax = boxMin + glm::vec3(FlatVoxelStorage::GetWindowSizeInVoxels()) - 2.0f;
+
+        VFloat3 t1 = (VFloat3(boxMin) - origin) * invDir;
+        VFloat3 t2 = (VFloat3(boxMax) - origin) * invDir;
+        VFloat3 tNear = { min(t1.x, t2.x), min(t1.y, t2.y), min(t1.z, t2.z) };
+        VFloat tEnter = max(max(max(tNear.x, tNear.y), tNear.z), startDist);
+        VFloat tExit = min(min(max(t1.x, t2.x), max(t1.y, t2.y)), max(t1.z, t2.z));
+
+        mask &= (tEnter < tExit) & (tExit > 0.0f);
+        VMask clipMask = mask & (tEnter > 0.0f);
+
+        SetLanes(clipMask, CurrPos, origin + dir * tEnter);
+        CurrDist.set_if(clipMask, tEnter);
+
+        // Rays that hit on the first step take the normal from the face the start voxel was entered through,
+        // which is the closest one behind the start position. This isn't necessarily the window face when
+        // clipped by `startDist`. SideDist is set so that its minimum is `tEnter` on that axis only.
+        VFloat3 startPos = origin + dir * tEnter;
+        VFloat3 backDist = {
+            csel(dir.x < 0, 1.0f - fract(startPos.x), fract(startPos.x)) / max(abs(dir.x), 1e-9f),
+            csel(dir.y < 0, 1.0f - fract(startPos.y), fract(startPos.y)) / max(abs(dir.y), 1e-9f),
+            csel(dir.z < 0, 1.0f - fract(startPos.z), fract(startPos.z)) / max(abs(dir.z), 1e-9f),
+        };
+        VMask entryX = (backDist.x <= backDist.y) & (backDist.x <= backDist.z);
+        VMask entryY = ~entryX & (backDist.y <= backDist.z);
+        VMask entryZ = ~entryX & ~entryY;
+
+        SetLanes(clipMask, SideDist, {
+            csel(entryX, tEnter, INFINITY),
+            csel(entryY, tEnter, INFINITY),
+            csel(entryZ, tEnter, INFINITY),
+        });
+        return mask;
+    }
 
-        inboundMask = GetInboundMask(voxelPos.x, voxelPos.y, voxelPos.z);
-        activeMask &= inboundMask;
-        VMask hitMask = GetStepPos(map, voxelPos, dir, activeMask);
+    // Advances lanes in `activeMask` by one cell, and removes those that hit or left the storage window.
+    // Returns the lanes that hit. Lanes in `coarseMask` may hit any occupied voxel in the 4x4x4 cell.
+    VMask Step(const FlatVoxelStorage& map, VMask& activeMask, VMask coarseMask, glm::ivec3 worldOrigin, const TraversalSettings& settings) {
+        VInt3 pos = worldOrigin + VInt3(floor2i(CurrPos.x), floor2i(CurrPos.y), floor2i(CurrPos.z));
+        activeMask &= GetInboundMask(map, pos.x, pos.y, pos.z);
 
+        VMask hitMask = GetStepPos(map, pos, Dir, activeMask, coarseMask & activeMask, settings, MaskCache);
         activeMask &= ~hitMask;
-        if (!any(activeMask)) break;
 
-        voxelPos -= worldOrigin;
-        sideDist.x.set_if(activeMask, tStart.x + conv2f(voxelPos.x) * invDir.x);
-        sideDist.y.set_if(activeMask, tStart.y + conv2f(voxelPos.y) * invDir.y);
-        sideDist.z.set_if(activeMask, tStart.z + conv2f(voxelPos.z) * invDir.z);
+        VoxelPos.x.set_if(hitMask, pos.x);
+        VoxelPos.y.set_if(hitMask, pos.y);
+        VoxelPos.z.set_if(hitMask, pos.z);
+
+        if (any(activeMask)) {
+            pos -= worldOrigin;
+            SideDist.x.set_if(activeMask, TStart.x + conv2f(pos.x) * InvDir.x);
+            SideDist.y.set_if(activeMask, TStart.y + conv2f(pos.y) * InvDir.y);
+            SideDist.z.set_if(activeMask, TStart.z + conv2f(pos.z) * InvDir.z);
+
+            VFloat tmin = min(min(SideDist.x, SideDist.y), SideDist.z) + 0.001f;
+            SetLanes(activeMask, CurrPos, Origin + tmin * Dir);
+            CurrDist.set_if(activeMask, tmin);
+
+            if (settings.CacheStepMasks) {
+                VInt3 nextPos = worldOrigin + VInt3(floor2i(CurrPos.x), floor2i(CurrPos.y), floor2i(CurrPos.z));
+                PrefetchNextBricks(map, nextPos, activeMask, MaskCache);
+            }
+        }
+        return hitMask;
+    }
 
-        VFloat tmin = min(min(sideDist.x, sideDist.y), sideDist.z) + 0.001f;
-        currPos = origin + tmin * dir;
+    VHitResult GetHit(const FlatVoxelStorage& map, VMask hitMask) const {
+        VFloat hitDist = min(min(SideDist.x, SideDist.y), SideDist.z);
+        VMask sideMaskX = SideDist.x == hitDist;
+        VMask sideMaskY = SideDist.y == hitDist;
+        VMask sideMaskZ = ~sideMaskX & ~sideMaskY;
+
+        return {
+            // Only fetch for lanes that hit, others may point to wrapped-around or evicted sectors
+            .MaterialData = GetVoxelMaterial(map, VoxelPos, hitMask),
+            .Distance = hitDist,
+            .Pos = CurrPos,
+            .Normal = {
+                csel(sideMaskX, (Dir.x & -0.0f) ^ VFloat(-1.0f), 0),  // dir.x < 0 ? +1 : -1
+                csel(sideMaskY, (Dir.y & -0.0f) ^ VFloat(-1.0f), 0),
+                csel(sideMaskZ, (Dir.z & -0.0f) ^ VFloat(-1.0f), 0),
+            },
+            .UV = {
+                fract(csel(sideMaskX, CurrPos.y, CurrPos.x)),
+                fract(csel(sideMaskZ, CurrPos.y, CurrPos.z)),
+            },
+            .Mask = hitMask,
+            .NumIters = 0,
+            .NumSteps = 0,
+        };
     }
+};
 
-    VFloat hitDist = min(min(sideDist.x, sideDist.y), sideDist.z);
-    VMask sideMaskX = sideDist.x == hitDist;
-    VMask sideMaskY = sideDist.y == hitDist;
-    VMask sideMaskZ = ~sideMaskX & ~sideMaskY;
+// Lanes start traversing at `startDist`, which must be before any surface along the ray.
+static VHitResult RayCast(const FlatVoxelStorage& map, VFloat3 origin, VFloat3 dir, VMask activeMask, glm::ivec3 worldOrigin,
+                          const TraversalSettings& settings, VFloat startDist = 0.0f) {
+    RayTraversal ray;
+    activeMask = ray.Begin(map, activeMask, origin, dir, worldOrigin, startDist);
 
-    return {
-        .MaterialData = GetVoxelMaterial(map, voxelPos, ~activeMask),
-        .Distance = hitDist,
-        .Pos = currPos,
-        .Normal = {
-            csel(sideMaskX, (dir.x & -0.0f) ^ VFloat(-1.0f), 0),  // dir.x < 0 ? +1 : -1
-            csel(sideMaskY, (dir.y & -0.0f) ^ VFloat(-1.0f), 0),
-            csel(sideMaskZ, (dir.z & -0.0f) ^ VFloat(-1.0f), 0),
-        },
-        .UV = {
-            fract(csel(sideMaskX, currPos.y, currPos.x)),
-            fract(csel(sideMaskZ, currPos.y, currPos.z)),
-        },
-        .Mask = (VMask)(~activeMask & inboundMask),
-    };
+    VMask hitMask = 0;
+    uint32_t numIters = 0, numSteps = 0;
+
+    for (uint32_t i = 0; i < MaxTraversalIters; i++) {
+        VMask coarseMask = 0;
+        if (settings.CoarseThreshold != 0) {
+            coarseMask = i >= settings.CoarseThreshold ? activeMask : activeMask & (ray.CurrDist >= (float)settings.CoarseThreshold);
+        }
+        VMask stepHitMask = ray.Step(map, activeMask, coarseMask, worldOrigin, settings);
+        numIters += simd::popcnt(activeMask | stepHitMask);  // lanes that were still in bounds
+        numSteps++;
+
+        hitMask |= stepHitMask;
+        if (!any(activeMask)) break;
+    }
+    VHitResult hit = ray.GetHit(map, hitMask);
+    hit.NumIters = numIters;
+    hit.NumSteps = numSteps;
+    return hit;
 }
 
 static void GetPrimaryRay(VFloat2 uv, const glm::mat4& invProjMat, VFloat3& rayPos, VFloat3& rayDir) {
@@ -255,6 +583,10 @@ struct alignas(64) VBlueNoise {
         assert(pos.x % simd::TileWidth == 0);
         assert(pos.y % simd::TileHeight == 0);
 
+        // Shift the pattern every 64 frames, so that long accumulations don't repeat the same samples.
+        // Wrapped to keep the offsets below precise in float.
+        sampleIdx += ((frameIdx >> 6) & 255) * 16;
+
         glm::vec2 sampleOffset = glm::fract(float(sampleIdx) * glm::vec2(0.75487766624669276005f, 0.56984029099805326591f) + 0.5f);
         pos = (pos + glm::uvec2(sampleOffset * 128.0f)) & 127u;
         pos.y += (frameIdx & 63) * 128;
@@ -296,21 +628,20 @@ static VFloat3 SampleHemisphere(VFloat2 sample, const VFloat3& normal) {
     return { dir.x ^ sign, dir.y ^ sign, dir.z ^ sign };
 }
 
-struct Framebuffer {
-    struct alignas(64) Tile {
-        VInt Albedo;        // RGBA8, A = normal
-        VFloat Depth;
-        VInt IrradianceRG;  // F16
-        VInt IrradianceBX;  // F16, u16 unused
-    };
-    uint32_t Width, Height, TileStride;
-    uint32_t TileShiftX, TileShiftY;
-    Tile Tiles[];
-};
-
 static swr::HdrTexture2D _skyBox = swr::texutil::LoadCubemapFromPanoramaHDR("assets/skyboxes/evening_road_01_puresky_4k.hdr");
 static VBlueNoise _blueNoise = VBlueNoise();
 
+struct TraversalCounters {
+    uint64_t NumRays = 0;
+    uint64_t NumIters = 0;
+    uint64_t NumSteps = 0;
+    uint64_t NumPrimaryRays = 0;
+    uint64_t NumPrimaryIters = 0;
+    uint64_t NumPrimarySteps = 0;
+    uint64_t NumCacheLookups = 0;  // First bounce hits looked up in the irradiance cache
+    uint64_t NumCacheHits = 0;
+};
+
 struct FrameConstants {
     FlatVoxelStorage& Storage;
     glm::uvec2 Size;
@@ -318,15 +649,524 @@ struct FrameConstants {
     glm::vec3 OriginFrac;
     uint32_t FrameNo;
     uint32_t NumLightBounces;
+    bool SortBounceRays;
+    bool UsePersistentLanes;
+    TraversalSettings PrimaryTraversal;
+    TraversalSettings BounceTraversal;
     glm::mat4 CurrentProj;
     glm::mat4 InvProj;
+
+    const float* BeamDists;  // Empty distance in front of each beam cell, or null if the beam prepass is disabled
+
+    const float* ReuseDists;  // Start distances per beam cell from reprojected depth, or null if unavailable
+    float* PrimaryDists;      // Output primary hit distances for depth reuse and lighting upsampling, in tile order. Null if disabled
+
+    CpuRenderer::LightingRate BounceRayRate;
+    float* PrimaryEmission;  // Output emission strength of primary hits for lighting upsampling, in tile order. Null if disabled
+
+    const IrradianceCache* Cache;  // Null if disabled
+};
+
+// Size of beam prepass cells in pixels, must be a multiple of the SIMD tile size.
+static const uint32_t BeamSize = 8;
+static const uint32_t MaxBeamIters = 256;
+
+// Returns whether any allocated brick may be in the given range of cells. Cells are bricks at level 0,
+// sectors at level 1 and sector groups at level 2, in world coords.
+static bool IsAnyCellOccupied(const FlatVoxelStorage& map, glm::ivec3 minCell, glm::ivec3 maxCell, uint32_t level) {
+    for (int32_t y = minCell.y; y <= maxCell.y; y++) {
+        for (int32_t z = minCell.z; z <= maxCell.z; z++) {
+            for (int32_t x = minCell.x; x <= maxCell.x; x++) {
+                glm::ivec3 pos = { x, y, z };
+                bool occupied;
+
+                if (level == 0) {
+                    uint64_t sectorMask = map.SectorMasks[ViewSectorIndexer::GetIndex(pos >> MaskIndexer::Shift)];
+                    occupied = (sectorMask >> MaskIndexer::GetIndex(pos) & 1) != 0;
+                } else if (level == 1) {
+                    occupied = map.SectorMasks[ViewSectorIndexer::GetIndex(pos)] != 0;
+                } else {
+                    occupied = map.SectorGroupMasks[SectorGroupIndexer::GetIndex(pos)] != 0;
+                }
+                if (occupied) return true;
+            }
+        }
+    }
+    return false;
+}
+
+// Marches a cone enclosing all rays of a beam, and returns the distance up to which it is known to be empty.
+// At distance t, every ray of the beam is within `radius + spread * t` of the axis. Each step checks that all
+// cells touched by that footprint over the step are empty, trying the coarsest level first.
+static float MarchBeamCone(const FrameConstants& fc, glm::vec3 origin, glm::vec3 dir, float radius, float spread, uint32_t& numIters) {
+    const FlatVoxelStorage& map = fc.Storage;
+    glm::vec3 windowMin = glm::vec3(map.GetWindowMinVoxelPos() - fc.WorldOrigin);
+    glm::vec3 windowMax = windowMin + glm::vec3(FlatVoxelStorage::GetWindowSizeInVoxels());
+    float dist = 0.0f;
+
+    for (; numIters < MaxBeamIters; numIters++) {
+        bool advanced = false;
+
+        for (int32_t level = 2; level >= 0 && !advanced; level--) {
+            int32_t shift = BrickIndexer::ShiftXZ + level * MaskIndexer::ShiftXZ;
+            float step = (float)(1 << shift) * 0.5f;
+
+            // Footprint is linear in t, so the box over both ends bounds it over the whole step
+            float footprint = radius + spread * (dist + step);
+            glm::vec3 boxMin = glm::min(origin + dir * dist, origin + dir * (dist + step)) - footprint;
+            glm::vec3 boxMax = glm::max(origin + dir * dist, origin + dir * (dist + step)) + footprint;
+
+            // Outside the window, rays are clipped by traversal anyway
+            if (glm::any(glm::lessThan(boxMin, windowMin)) || glm::any(glm::greaterThanEqual(boxMax, windowMax))) continue;
+
+            glm::ivec3 minCell = (glm::ivec3(glm::floor(boxMin)) + fc.WorldOrigin) >> shift;
+            glm::ivec3 maxCell = (glm::ivec3(glm::floor(boxMax)) + fc.WorldOrigin) >> shift;
+            glm::ivec3 numCells = maxCell - minCell + 1;
+
+            // Footprint is too wide for this level to be worth checking
+            if (numCells.x * numCells.y * numCells.z > 64) continue;
+
+            if (!IsAnyCellOccupied(map, minCell, maxCell, (uint32_t)level)) {
+                dist += step;
+                advanced = true;
+            }
+        }
+        if (!advanced) break;
+    }
+    return dist;
+}
+
+// Marches a cone for each beam in a row of beams. Primary rays inside each beam can safely start at its distance.
+[[gnu::noinline]]
+static void TraceBeamRow(const FrameConstants& fc, float* dest, uint32_t y, uint32_t numCells, TraversalCounters& counters) {
+    // Same as GetPrimaryRay()
+    const auto getRay = [&](glm::vec2 pos, glm::vec3& rayPos, glm::vec3& rayDir) {
+        glm::vec4 nearPos = fc.InvProj * glm::vec4(pos, 0, 1);
+        glm::vec4 farPos = nearPos + fc.InvProj[2];
+        rayPos = glm::vec3(nearPos) / nearPos.w;
+        rayDir = glm::normalize(glm::vec3(farPos) / farPos.w);
+    };
+
+    for (uint32_t x = 0; x < numCells; x++) {
+        // Pixel edges rather than centers, so the cone also covers any sample jitter within the pixel
+        glm::vec2 beamMin = glm::vec2(x, y) * (float)BeamSize;
+        glm::vec3 origin, dir;
+        getRay(beamMin + BeamSize * 0.5f, origin, dir);
+
+        // Distance between rays is largest at the corners, both for their near plane origins and directions
+        float radius = 0.0f, spread = 0.0f;
+
+        for (uint32_t i = 0; i < 4; i++) {
+            glm::vec3 cornerOrigin, cornerDir;
+            getRay(beamMin + glm::vec2(i & 1, i >> 1) * (float)BeamSize, cornerOrigin, cornerDir);
+            radius = std::max(radius, glm::distance(cornerOrigin, origin));
+            spread = std::max(spread, glm::distance(cornerDir, dir));
+        }
+        origin += fc.OriginFrac;
+
+        uint32_t numIters = 0;
+        float dist = MarchBeamCone(fc, origin, dir, radius + 0.01f, spread * 1.01f, numIters);
+        counters.NumIters += numIters;
+
+        // Primary ray directions are normalized with approx rsqrt, so distances along them may be slightly longer
+        dest[x] = dist * (1.0f - 1.0f / 1024);
+    }
+}
+
+// Returns the distance that primary rays in the tile at the given pixel can skip, based on the beam prepass
+// and reprojected depth.
+static VFloat GetPrimaryStartDist(const FrameConstants& fc, uint32_t x, uint32_t y) {
+    uint32_t cellX = x / BeamSize, cellY = y / BeamSize;
+    uint32_t numCellsX = (fc.Size.x + BeamSize - 1) / BeamSize;
+    float dist = 0.0f;
+
+    if (fc.BeamDists != nullptr) {
+        dist = fc.BeamDists[cellY * numCellsX + cellX];
+    }
+    if (fc.ReuseDists != nullptr) {
+        dist = std::max(dist, fc.ReuseDists[cellY * numCellsX + cellX]);
+    }
+    return dist;
+}
+
+// Lanes of primary rays whose start voxel is already solid hit on the first step, meaning the start distance
+// was past a surface for them. Those are traced again from the camera instead of shading the wrong hit.
+static void RestartFirstStepHits(const FrameConstants& fc, VFloat3 origin, VFloat3 dir, VFloat startDist, VHitResult& hit) {
+    // Hits past the first step are always farther than the start, see RayTraversal::Begin()
+    VMask restartMask = hit.Mask & (startDist > 0.0f) & (hit.Distance <= startDist);
+    if (!any(restartMask)) return;
+
+    VHitResult fullHit = RayCast(fc.Storage, origin, dir, restartMask, fc.WorldOrigin, fc.PrimaryTraversal);
+
+    hit.MaterialData.set_if(restartMask, fullHit.MaterialData);
+    hit.Distance.set_if(restartMask, fullHit.Distance);
+    SetLanes(restartMask, hit.Pos, fullHit.Pos);
+    SetLanes(restartMask, hit.Normal, fullHit.Normal);
+    hit.UV.x.set_if(restartMask, fullHit.UV.x);
+    hit.UV.y.set_if(restartMask, fullHit.UV.y);
+    hit.Mask = (hit.Mask & ~restartMask) | fullHit.Mask;
+    hit.NumIters += fullHit.NumIters;
+    hit.NumSteps += fullHit.NumSteps;
+}
+
+// Casts primary rays for the tile at the given pixel, starting from GetPrimaryStartDist().
+static VHitResult RayCastPrimary(const FrameConstants& fc, VFloat3 origin, VFloat3 dir, VMask mask, uint32_t x, uint32_t y) {
+    VFloat startDist = GetPrimaryStartDist(fc, x, y);
+    VHitResult hit = RayCast(fc.Storage, origin, dir, mask, fc.WorldOrigin, fc.PrimaryTraversal, startDist);
+    RestartFirstStepHits(fc, origin, dir, startDist, hit);
+    return hit;
+}
+
+static void StorePrimaryDists(const FrameConstants& fc, uint32_t x, uint32_t y, const VHitResult& hit) {
+    if (fc.PrimaryDists == nullptr) return;
+
+    uint32_t tileIdx = (y / simd::TileHeight) * (fc.Size.x / simd::TileWidth) + (x / simd::TileWidth);
+    csel(hit.Mask, hit.Distance, INFINITY).store(&fc.PrimaryDists[tileIdx * simd::VectorWidth]);
+}
+
+static void StorePrimaryEmission(const FrameConstants& fc, uint32_t x, uint32_t y, const VHitResult& hit, VFloat emissionStrength) {
+    if (fc.PrimaryEmission == nullptr) return;
+
+    uint32_t tileIdx = (y / simd::TileHeight) * (fc.Size.x / simd::TileWidth) + (x / simd::TileWidth);
+    csel(hit.Mask, emissionStrength, 0.0f).store(&fc.PrimaryEmission[tileIdx * simd::VectorWidth]);
+}
+
+// Order in which pixels of each 2x2 quad trace bounces at quarter rate, alternating diagonals.
+static const uint32_t QuarterRateOrder[4] = { 0, 3, 1, 2 };
+
+// Returns whether the given pixel traces bounce rays this frame, at reduced rate lighting.
+// The pattern shifts every frame, so that temporal accumulation eventually covers all pixels.
+static bool IsLightingPixel(const FrameConstants& fc, uint32_t x, uint32_t y) {
+    switch (fc.BounceRayRate) {
+        case CpuRenderer::LightingRate::Checkerboard: return ((x + y + fc.FrameNo) & 1) == 0;
+        case CpuRenderer::LightingRate::Quarter: return ((x & 1) | (y & 1) << 1) == QuarterRateOrder[fc.FrameNo & 3];
+        default: return true;
+    }
+}
+static VMask GetLightingMask(const FrameConstants& fc, uint32_t x, uint32_t y) {
+    VInt px = (int32_t)x + simd::TileOffsetsX;
+    VInt py = (int32_t)y + simd::TileOffsetsY;
+
+    switch (fc.BounceRayRate) {
+        case CpuRenderer::LightingRate::Checkerboard: return ((px + py + (int32_t)fc.FrameNo) & 1) == 0;
+        case CpuRenderer::LightingRate::Quarter: return ((px & 1) | (py & 1) << 1) == (int32_t)QuarterRateOrder[fc.FrameNo & 3];
+        default: return (VMask)(~0);
+    }
+}
+
+// Fills in irradiance for a row of tiles, at pixels that didn't trace bounce rays, from neighbors that did.
+// Neighbors must have the same normal and are weighted by hit distance, so that lighting doesn't leak over edges.
+// Only non-lighting pixels are written, so rows can be processed in parallel.
+[[gnu::noinline]]
+static void UpsampleLightingRow(const FrameConstants& fc, Framebuffer& fb, uint32_t tileY) {
+    // Same order as PrimaryDists and PrimaryEmission
+    const auto getPixelIdx = [&](uint32_t x, uint32_t y) {
+        uint32_t tileIdx = (y >> fb.TileShiftY) * fb.TileStride + (x >> fb.TileShiftX);
+        return tileIdx * simd::VectorWidth + (x & (simd::TileWidth - 1)) + (y & (simd::TileHeight - 1)) * simd::TileWidth;
+    };
+    const auto getIndirect = [&](uint32_t idx) {
+        const Framebuffer::Tile& tile = fb.Tiles[idx / simd::VectorWidth];
+        uint32_t lane = idx % simd::VectorWidth;
+        glm::vec2 irradianceRG = glm::unpackHalf2x16((uint32_t)tile.IrradianceRG[lane]);
+        glm::vec2 irradianceBX = glm::unpackHalf2x16((uint32_t)tile.IrradianceBX[lane]);
+        return glm::vec3(irradianceRG, irradianceBX.x) - fc.PrimaryEmission[idx];
+    };
+    const auto getNormalId = [&](uint32_t idx) { return fb.Tiles[idx / simd::VectorWidth].Albedo[idx % simd::VectorWidth] >> 24 & 63; };
+
+    for (uint32_t y = tileY * simd::TileHeight; y < (tileY + 1) * simd::TileHeight; y++) {
+        for (uint32_t x = 0; x < fb.Width; x++) {
+            if (IsLightingPixel(fc, x, y)) continue;
+
+            uint32_t idx = getPixelIdx(x, y);
+            float dist = fc.PrimaryDists[idx];
+            if (dist == INFINITY) continue;  // sky
+
+            int32_t normalId = getNormalId(idx);
+            glm::vec3 sum = glm::vec3(0.0f), fallbackSum = glm::vec3(0.0f);
+            float wsum = 0.0f;
+            uint32_t numFallbackSamples = 0;
+
+            for (int32_t dy = -1; dy <= 1; dy++) {
+                for (int32_t dx = -1; dx <= 1; dx++) {
+                    uint32_t sx = x + dx, sy = y + dy;
+                    if (sx >= fb.Width || sy >= fb.Height || !IsLightingPixel(fc, sx, sy)) continue;
+
+                    uint32_t sampleIdx = getPixelIdx(sx, sy);
+                    float sampleDist = fc.PrimaryDists[sampleIdx];
+                    if (sampleDist == INFINITY) continue;
+
+                    glm::vec3 indirect = getIndirect(sampleIdx);
+                    fallbackSum += indirect;
+                    numFallbackSamples++;
+
+                    if (getNormalId(sampleIdx) != normalId) continue;
+
+                    float w = 1.0f / (1.0f + std::abs(sampleDist - dist) / dist * 32.0f);
+                    sum += indirect * w;
+                    wsum += w;
+                }
+            }
+            // Isolated pixels, e.g. on thin geometry, take whatever is around rather than going black
+            glm::vec3 indirect = wsum > 0.0f ? sum / wsum : numFallbackSamples > 0 ? fallbackSum / (float)numFallbackSamples : glm::vec3(0.0f);
+            glm::vec3 irradiance = glm::max(indirect, 0.0f) + fc.PrimaryEmission[idx];
+
+            Framebuffer::Tile& tile = fb.Tiles[idx / simd::VectorWidth];
+            uint32_t lane = idx % simd::VectorWidth;
+            tile.IrradianceRG[lane] = (int32_t)glm::packHalf2x16(glm::vec2(irradiance.x, irradiance.y));
+            tile.IrradianceBX[lane] = (int32_t)glm::packHalf2x16(glm::vec2(irradiance.z, 0.0f));
+        }
+    }
+}
+
+// Extra distance kept before reprojected hits, to cover surfaces seen at a different angle.
+static const float ReuseSafetyMargin = 2.0f;
+// Start distances feed the next frame's reprojection, so a surface that was skipped once would stay skipped.
+// Every frame, 1 in N cells ignores reprojection and traces from the camera, so mistakes last at most N frames.
+static const uint32_t ReuseRefreshInterval = 8;
+// Camera translation per frame above which reprojected depth is dropped, as disocclusions get too large.
+static const float MaxReuseTranslation = 16.0f;
+
+// Reprojects a row of tiles of the previous frame primary hits into the current view, writing
+// the min distance from the current camera into `dest` per pixel, as float bits.
+[[gnu::noinline]]
+static void ReprojectPrimaryDists(const float* prevDists, uint32_t* dest, uint32_t y, glm::uvec2 viewSize, const glm::mat4& prevInvProj,
+                                  const glm::mat4& currProj, glm::vec3 posDelta) {
+    VFloat v = simd::conv2f((int32_t)y + simd::TileOffsetsY) + 0.5f;
+
+    for (uint32_t x = 0; x < viewSize.x; x += simd::TileWidth) {
+        VFloat u = simd::conv2f((int32_t)x + simd::TileOffsetsX) + 0.5f;
+        VFloat dist = VFloat::load(prevDists);
+        prevDists += simd::VectorWidth;
+
+        VMask mask = dist < INFINITY;
+        if (!any(mask)) continue;
+
+        VFloat3 origin, dir;
+        GetPrimaryRay({ u, v }, prevInvProj, origin, dir);
+        VFloat3 pos = origin + dist * dir + VFloat3(posDelta);
+
+        VFloat4 screenPos = simd::TransformVector(currProj, { pos, 1.0f });
+        VFloat rw = 1.0f / screenPos.w;
+        VInt px = floor2i(screenPos.x * rw);
+        VInt py = floor2i(screenPos.y * rw);
+        VFloat currDist = simd::approx_sqrt(simd::dot(pos, pos));
+
+        mask &= (screenPos.w > 0.0f) & simd::ucmp_lt(px, (int32_t)viewSize.x) & simd::ucmp_lt(py, (int32_t)viewSize.y);
+
+        for (uint32_t lane : BitIter<uint32_t>(mask)) {
+            auto destDist = std::atomic_ref(dest[px[lane] + py[lane] * viewSize.x]);
+            uint32_t newBits = std::bit_cast<uint32_t>(currDist[lane]);
+            uint32_t currBits = destDist.load(std::memory_order_relaxed);
+
+            // Positive floats order the same as their bits
+            while (newBits < currBits && !destDist.compare_exchange_weak(currBits, newBits, std::memory_order_relaxed)) {
+            }
+        }
+    }
+}
+
+// Reduces a row of reprojected distances into start distances per beam cell.
+// Cells with any pixel that was not covered by reprojection, or due for a refresh, fall back to full traversal.
+// Holes are not filled from neighbors, since a disoccluded surface behind them can be closer than any of those.
+[[gnu::noinline]]
+static void ReduceReprojectedDists(const uint32_t* dists, float* dest, uint32_t cellY, glm::uvec2 viewSize, uint32_t frameNo) {
+    uint32_t startY = cellY * BeamSize, endY = std::min(startY + BeamSize, viewSize.y);
+
+    for (uint32_t startX = 0; startX < viewSize.x; startX += BeamSize) {
+        uint32_t endX = std::min(startX + BeamSize, viewSize.x);
+        float minDist = INFINITY;
+
+        // Spread refreshed cells over the screen, each one comes up once every ReuseRefreshInterval frames
+        if ((startX / BeamSize + cellY * 3 + frameNo) % ReuseRefreshInterval == 0) {
+            *dest++ = 0.0f;
+            continue;
+        }
+
+        for (uint32_t y = startY; y < endY && minDist >= 0; y++) {
+            for (uint32_t x = startX; x < endX; x++) {
+                float dist = std::bit_cast<float>(dists[x + y * viewSize.x]);
+
+                if (dist == INFINITY) {
+                    minDist = -1;
+                    break;
+                }
+                minDist = std::min(minDist, dist);
+            }
+        }
+        *dest++ = std::max(minDist * 0.98f - ReuseSafetyMargin, 0.0f);
+    }
+}
+
+// World-space cache of diffuse irradiance on voxel faces. It is filled by the path tracer and looked up at
+// first bounce hits, so that most pixels don't have to trace the remaining bounces every frame.
+// Faces near the camera get one entry per voxel, farther ones share one per brick.
+// Entries are only read during rendering, new samples are buffered per worker and merged after the frame.
+struct IrradianceCache {
+    static const uint32_t BucketIndexBits = 16;
+    static const uint32_t NumBuckets = 1 << BucketIndexBits;
+    static const uint32_t BucketSize = 4;     // Entries per bucket, the least recently updated one is replaced
+    static const uint32_t NumShards = 64;     // Bucket ranges that are merged and invalidated in parallel
+    static const uint32_t MinSamples = 8;     // Samples before an entry is used
+    static const uint32_t MaxSamples = 64;    // Window of the moving average. Higher is smoother, but adapts slower to lighting changes
+    static const uint32_t RefreshRate = 16;   // 1 in N lookups of valid entries are traced anyway, to keep them up to date
+    static constexpr float NearDist = 64.0f;  // Distance from the camera up to which entries are per voxel face
+
+    struct Entry {
+        uint64_t Key = 0;  // 0 if empty
+        float Irradiance[3] = {};
+        uint32_t NumSamples = 0;
+        uint32_t LastUpdateFrame = 0;
+    };
+    struct Sample {
+        uint64_t Key;
+        glm::vec3 Irradiance;
+    };
+    // Samples traced by a single worker, grouped by shard.
+    struct SampleBuffer {
+        std::vector<Sample> Shards[NumShards];
+
+        void Add(uint64_t key, glm::vec3 irradiance) {
+            Shards[GetBucketIndex(key) / (NumBuckets / NumShards)].push_back({ key, irradiance });
+        }
+    };
+
+    std::vector<Entry> Entries = std::vector<Entry>(NumBuckets * BucketSize);
+    std::vector<SampleBuffer> WorkerSamples;
+    uint32_t NumLightBounces;  // Bounce count that entries were traced with, including the first
+
+    IrradianceCache(uint32_t numWorkers, uint32_t numLightBounces) : WorkerSamples(numWorkers), NumLightBounces(numLightBounces) {}
+
+    // Looks up irradiance at the first bounce hits in `mask`. Returns the lanes that can use the cached value, and writes
+    // the keys of all lanes so that the others can be traced further and added as samples.
+    // `pixelSeed` picks a few lanes every frame that are traced even if they have a valid entry.
+    VMask Lookup(const FrameConstants& fc, const VHitResult& hit, VMask mask, VInt pixelSeed, uint64_t* keys, VFloat3& irradiance) const {
+        // Hits are on voxel faces, move half a voxel inwards to get the one that was hit
+        VInt3 voxelPos = {
+            floor2i(hit.Pos.x - hit.Normal.x * 0.5f) + fc.WorldOrigin.x,
+            floor2i(hit.Pos.y - hit.Normal.y * 0.5f) + fc.WorldOrigin.y,
+            floor2i(hit.Pos.z - hit.Normal.z * 0.5f) + fc.WorldOrigin.z,
+        };
+        VInt face = csel(hit.Normal.x != 0.0f, VInt(0), csel(hit.Normal.y != 0.0f, VInt(2), VInt(4)));
+        face += csel(hit.Normal.x + hit.Normal.y + hit.Normal.z > 0.0f, VInt(1), VInt(0));
+        VInt perVoxel = csel(simd::dot(hit.Pos, hit.Pos) < NearDist * NearDist, VInt(1), VInt(0));
+
+        VInt refreshHash = pixelSeed * (int32_t)0x9E3779B1 + (int32_t)(fc.FrameNo * 0x85EBCA6Bu);
+        VInt refresh = csel(simd::ucmp_lt(refreshHash, VInt((int32_t)(0xFFFFFFFFu / RefreshRate))), VInt(1), VInt(0));
+        VInt cached = 0;
+        irradiance = 0.0f;
+
+        for (uint32_t lane : BitIter<uint32_t>(mask)) {
+            glm::ivec3 pos = { voxelPos.x[lane], voxelPos.y[lane], voxelPos.z[lane] };
+            keys[lane] = GetKey(pos, (uint32_t)face[lane], perVoxel[lane] != 0);
+
+            const Entry* entry = Find(keys[lane]);
+            if (entry == nullptr || entry->NumSamples < MinSamples || refresh[lane] != 0) continue;
+
+            irradiance.x[lane] = entry->Irradiance[0];
+            irradiance.y[lane] = entry->Irradiance[1];
+            irradiance.z[lane] = entry->Irradiance[2];
+            cached[lane] = 1;
+        }
+        return mask & (cached != 0);
+    }
+
+    // Merges samples traced during the frame into the cache.
+    void Merge(uint32_t frameNo, glim::ThreadPool& threadPool) {
+        threadPool.ParallelFor(NumShards, [&](uint32_t shardIdx, uint32_t workerIdx) {
+            for (auto& worker : WorkerSamples) {
+                for (auto& sample : worker.Shards[shardIdx]) {
+                    AddSample(sample, frameNo);
+                }
+                worker.Shards[shardIdx].clear();
+            }
+        });
+    }
+
+    // Drops entries in and around the sectors in DirtyLocs, must be called before they are synced.
+    // Edits change lighting beyond the modified bricks, so whole sectors and their neighbors are dropped.
+    void Invalidate(const VoxelMap& map, glim::ThreadPool& threadPool) {
+        std::unordered_set<uint32_t> dirtySectors;
+
+        for (auto& [sectorIdx, dirtyMask] : map.DirtyLocs) {
+            glm::ivec3 sectorPos = WorldSectorIndexer::GetPos(sectorIdx);
+
+            for (int32_t i = 0; i < 27; i++) {
+                glm::ivec3 offset = glm::ivec3(i % 3, i / 3 % 3, i / 9) - 1;
+                dirtySectors.insert(WorldSectorIndexer::GetIndex(sectorPos + offset));
+            }
+        }
+        threadPool.ParallelFor(NumShards, [&](uint32_t shardIdx, uint32_t workerIdx) {
+            const uint32_t entriesPerShard = NumBuckets / NumShards * BucketSize;
+
+            for (uint32_t i = shardIdx * entriesPerShard; i < (shardIdx + 1) * entriesPerShard; i++) {
+                if (Entries[i].Key == 0) continue;
+
+                glm::ivec3 sectorPos = GetVoxelPos(Entries[i].Key) >> (BrickIndexer::Shift + MaskIndexer::Shift);
+                if (dirtySectors.contains(WorldSectorIndexer::GetIndex(sectorPos))) {
+                    Entries[i] = {};
+                }
+            }
+        });
+    }
+
+private:
+    static const uint32_t KeyCoordBits = 19;
+
+    // Key layout: valid flag, per-voxel flag, 3 bits face, 19 bits per coord.
+    // Face is `axis * 2 + (normal > 0)`. Per-brick entries store brick coords.
+    static uint64_t GetKey(glm::ivec3 voxelPos, uint32_t face, bool perVoxel) {
+        glm::uvec3 pos = glm::uvec3(perVoxel ? voxelPos : voxelPos >> BrickIndexer::Shift) & ((1u << KeyCoordBits) - 1);
+        return 1ull << 63 | (uint64_t)perVoxel << 62 | (uint64_t)face << (KeyCoordBits * 3) |
+               (uint64_t)pos.x << (KeyCoordBits * 2) | (uint64_t)pos.y << KeyCoordBits | pos.z;
+    }
+    // Returns the min voxel position covered by the entry.
+    static glm::ivec3 GetVoxelPos(uint64_t key) {
+        const auto unpack = [&](uint32_t shift) { return (int32_t)((uint32_t)(key >> shift) << (32 - KeyCoordBits)) >> (32 - KeyCoordBits); };
+        glm::ivec3 pos = { unpack(KeyCoordBits * 2), unpack(KeyCoordBits), unpack(0) };
+        return (key >> 62 & 1) ? pos : pos << BrickIndexer::Shift;
+    }
+    static uint32_t GetBucketIndex(uint64_t key) {
+        return (uint32_t)((key * 0x9E3779B97F4A7C15ull) >> (64 - BucketIndexBits));
+    }
+
+    const Entry* Find(uint64_t key) const {
+        const Entry* bucket = &Entries[GetBucketIndex(key) * BucketSize];
+
+        for (uint32_t i = 0; i < BucketSize; i++) {
+            if (bucket[i].Key == key) return &bucket[i];
+        }
+        return nullptr;
+    }
+    void AddSample(const Sample& sample, uint32_t frameNo) {
+        Entry* bucket = &Entries[GetBucketIndex(sample.Key) * BucketSize];
+        Entry* entry = &bucket[0];
+
+        for (uint32_t i = 0; i < BucketSize; i++) {
+            if (bucket[i].Key == sample.Key) {
+                entry = &bucket[i];
+                break;
+            }
+            if (bucket[i].LastUpdateFrame < entry->LastUpdateFrame) entry = &bucket[i];
+        }
+        if (entry->Key != sample.Key) {
+            *entry = { .Key = sample.Key };
+        }
+        entry->NumSamples = std::min(entry->NumSamples + 1, MaxSamples);
+        float weight = 1.0f / entry->NumSamples;
+
+        for (uint32_t i = 0; i < 3; i++) {
+            entry->Irradiance[i] += (sample.Irradiance[i] - entry->Irradiance[i]) * weight;
+        }
+        entry->LastUpdateFrame = frameNo;
+    }
 };
 
 [[gnu::noinline]] // lambdas can't be debugged on release for some reason
-static void RenderRow(const FrameConstants& fc, Framebuffer::Tile* dest, uint32_t y) {
+static void RenderRow(const FrameConstants& fc, Framebuffer::Tile* dest, uint32_t y, uint32_t startX, uint32_t endX, TraversalCounters& counters,
+                      IrradianceCache::SampleBuffer* cacheSamples) {
     VFloat v = simd::conv2f((int32_t)y + simd::TileOffsetsY) + 0.5f;  // + rng.NextUnsignedFloat() - 0.5f;
     
-    for (uint32_t x = 0; x < fc.Size.x; x += simd::TileWidth) {
+    for (uint32_t x = startX; x < endX; x += simd::TileWidth) {
         VFloat u = simd::conv2f((int32_t)x + simd::TileOffsetsX) + 0.5f;  // + rng.NextUnsignedFloat() - 0.5f;
 
         VFloat3 origin, dir;
@@ -339,8 +1179,18 @@ static void RenderRow(const FrameConstants& fc, Framebuffer::Tile* dest, uint32_
         VFloat3 throughput = 1.0f;
         VMask mask = (VMask)(~0);
 
+        // State of the irradiance cache lookup at the first bounce
+        bool cacheLookedUp = false;
+        VMask fillMask = 0;  // Lanes traced further to add cache samples
+        VFloat3 fillBaseIrradiance, fillThroughput;
+        uint64_t cacheKeys[simd::VectorWidth];
+
         for (uint32_t i = 0; i <= fc.NumLightBounces && any(mask); i++) {
-            auto hit = RayCast(fc.Storage, origin, dir, mask, fc.WorldOrigin);
+            auto hit = i == 0 ? RayCastPrimary(fc, origin, dir, mask, x, y)
+                              : RayCast(fc.Storage, origin, dir, mask, fc.WorldOrigin, fc.BounceTraversal);
+            counters.NumRays += simd::popcnt(mask);
+            counters.NumIters += hit.NumIters;
+            counters.NumSteps += hit.NumSteps;
 
             VFloat3 matColor = hit.GetColor();
             VFloat emissionStrength = hit.GetEmissionStrength();
@@ -368,6 +1218,12 @@ static void RenderRow(const FrameConstants& fc, Framebuffer::Tile* dest, uint32_
                 }
             }
             if (i == 0) {
+                counters.NumPrimaryRays += simd::popcnt(mask);
+                counters.NumPrimaryIters += hit.NumIters;
+                counters.NumPrimarySteps += hit.NumSteps;
+                StorePrimaryDists(fc, x, y, hit);
+                StorePrimaryEmission(fc, x, y, hit, emissionStrength);
+
                 albedo = swr::pixfmt::RGBA8u::Pack({ matColor, 0.0f });
                 albedo |= (round2i(hit.Normal.x) + 1) << 24;
                 albedo |= (round2i(hit.Normal.y) + 1) << 26;
@@ -380,17 +1236,41 @@ static void RenderRow(const FrameConstants& fc, Framebuffer::Tile* dest, uint32_
                     irradiance = 1.0f;
                     break;
                 }
+                mask &= GetLightingMask(fc, x, y);
             } else {
                 throughput *= matColor;
             }
             irradiance += throughput * emissionStrength;
             mask &= hit.Mask;
 
+            if (i == 1 && fc.Cache != nullptr && any(mask)) {
+                // Lanes with cached irradiance stop here. Radiance of the others is accumulated separately
+                // from here on, so that it can be added as a cache sample.
+                VInt pixelSeed = ((int32_t)x + simd::TileOffsetsX) + ((int32_t)y + simd::TileOffsetsY) * (int32_t)fc.Size.x;
+                VFloat3 cachedIrradiance;
+                VMask cachedMask = fc.Cache->Lookup(fc, hit, mask, pixelSeed, cacheKeys, cachedIrradiance);
+                counters.NumCacheLookups += simd::popcnt(mask);
+                counters.NumCacheHits += simd::popcnt(cachedMask);
+
+                cacheLookedUp = true;
+                fillMask = mask & ~cachedMask;
+                fillBaseIrradiance = irradiance + throughput * cachedIrradiance;
+                fillThroughput = throughput;
+                irradiance = 0.0f;
+                throughput = 1.0f;
+                mask = fillMask;
+            }
             origin = hit.Pos + hit.Normal * 0.01f;
 
             VFloat2 bn = _blueNoise.Sample(glm::uvec2(x, y), fc.FrameNo, i);
             dir = simd::normalize(hit.Normal + SampleDirection(bn));  // lambertian
         }
+        if (cacheLookedUp) {
+            for (uint32_t lane : BitIter<uint32_t>(fillMask)) {
+                cacheSamples->Add(cacheKeys[lane], { irradiance.x[lane], irradiance.y[lane], irradiance.z[lane] });
+            }
+            irradiance = fillBaseIrradiance + fillThroughput * irradiance;
+        }
         // Write out entire tile at once in hopes for better write-combining or whatever
         *dest++ = {
             .Albedo = albedo,
@@ -401,96 +1281,1101 @@ static void RenderRow(const FrameConstants& fc, Framebuffer::Tile* dest, uint32_
     }
 }
 
-CpuRenderer::CpuRenderer(ogl::ShaderLib& shlib, std::shared_ptr<VoxelMap> map) {
+// Scratch buffers for rendering a pixel block in wavefront order.
+// Per-pixel arrays are indexed by `localTileIdx * VectorWidth + lane`, so they can be accessed with plain vector loads.
+struct WavefrontScratch {
+    // Structure-of-arrays queue of rays. Rays are appended densely so that they can be
+    // regrouped into full packets regardless of which pixels they came from.
+    struct RayQueue {
+        enum Attrib { OriginX, OriginY, OriginZ, DirX, DirY, DirZ, ThroughputX, ThroughputY, ThroughputZ, NumAttribs };
+
+        std::vector<float> Attribs;
+        std::vector<uint32_t> PixelIndices;
+        uint32_t Capacity = 0, Count = 0;
+
+        void Push(VMask mask, const VFloat3& origin, const VFloat3& dir, const VFloat3& throughput, VInt pixelIdx) {
+            for (uint32_t lane : BitIter<uint32_t>(mask)) {
+                uint32_t i = Count++;
+                Attribs[OriginX * Capacity + i] = origin.x[lane];
+                Attribs[OriginY * Capacity + i] = origin.y[lane];
+                Attribs[OriginZ * Capacity + i] = origin.z[lane];
+                Attribs[DirX * Capacity + i] = dir.x[lane];
+                Attribs[DirY * Capacity + i] = dir.y[lane];
+                Attribs[DirZ * Capacity + i] = dir.z[lane];
+                Attribs[ThroughputX * Capacity + i] = throughput.x[lane];
+                Attribs[ThroughputY * Capacity + i] = throughput.y[lane];
+                Attribs[ThroughputZ * Capacity + i] = throughput.z[lane];
+                PixelIndices[i] = pixelIdx[lane];
+            }
+        }
+        // Loads the packet starting at `offset`, returns mask of valid lanes.
+        VMask Load(uint32_t offset, VFloat3& origin, VFloat3& dir, VFloat3& throughput, VInt& pixelIdx) const {
+            const auto load = [&](Attrib attrib) { return VFloat::load(&Attribs[attrib * Capacity + offset]); };
+            origin = { load(OriginX), load(OriginY), load(OriginZ) };
+            dir = { load(DirX), load(DirY), load(DirZ) };
+            throughput = { load(ThroughputX), load(ThroughputY), load(ThroughputZ) };
+            pixelIdx = VInt::load(&PixelIndices[offset]);
+
+            return simd::LaneIdx < (int32_t)(Count - offset);
+        }
+
+        // Reorders rays by direction octant, then by origin brick along a Z-order curve, so that
+        // rays in the same packet are more likely to visit the same bricks and cache lines.
+        // `temp` must have the same capacity, its buffers are swapped with this queue's.
+        void SortForCoherence(RayQueue& temp, std::vector<uint64_t>& keys) {
+            const auto spread3 = [](uint32_t v) {
+                v = (v | v << 16) & 0x030000FF;
+                v = (v | v << 8) & 0x0300F00F;
+                v = (v | v << 4) & 0x030C30C3;
+                v = (v | v << 2) & 0x09249249;
+                return v;
+            };
+            keys.resize(Count);
+
+            for (uint32_t i = 0; i < Count; i++) {
+                uint32_t octant = (Attribs[DirX * Capacity + i] < 0) | (Attribs[DirY * Capacity + i] < 0) << 1 | (Attribs[DirZ * Capacity + i] < 0) << 2;
+
+                // Origins are relative to the camera, 9 bits per axis covers +-256 bricks
+                glm::ivec3 brickPos = glm::ivec3(glm::floor(glm::vec3(Attribs[OriginX * Capacity + i], Attribs[OriginY * Capacity + i], Attribs[OriginZ * Capacity + i]))) >> 3;
+                glm::uvec3 biasedPos = glm::uvec3(brickPos + 256) & 511u;
+                uint32_t morton = spread3(biasedPos.x) | spread3(biasedPos.y) << 1 | spread3(biasedPos.z) << 2;
+
+                keys[i] = (uint64_t)(octant << 27 | morton) << 32 | i;
+            }
+            std::sort(keys.begin(), keys.end());
+
+            for (uint32_t i = 0; i < Count; i++) {
+                uint32_t srcIdx = (uint32_t)keys[i];
+
+                for (uint32_t j = 0; j < NumAttribs; j++) {
+                    temp.Attribs[j * Capacity + i] = Attribs[j * Capacity + srcIdx];
+                }
+                temp.PixelIndices[i] = PixelIndices[srcIdx];
+            }
+            std::swap(Attribs, temp.Attribs);
+            std::swap(PixelIndices, temp.PixelIndices);
+        }
+    };
+    // Hit results of the rays in a queue, in the same order. Misses have negative distance.
+    struct HitQueue {
+        enum Attrib { Distance, PosX, PosY, PosZ, NormalX, NormalY, NormalZ, NumAttribs };
+
+        std::vector<float> Attribs;
+        std::vector<int32_t> MaterialData;
+        uint32_t Capacity = 0;
+
+        void Store(VMask mask, VInt rayIdx, const VHitResult& hit) {
+            VFloat dist = csel(hit.Mask, hit.Distance, -1.0f);
+
+            for (uint32_t lane : BitIter<uint32_t>(mask)) {
+                uint32_t i = (uint32_t)rayIdx[lane];
+                Attribs[Distance * Capacity + i] = dist[lane];
+                Attribs[PosX * Capacity + i] = hit.Pos.x[lane];
+                Attribs[PosY * Capacity + i] = hit.Pos.y[lane];
+                Attribs[PosZ * Capacity + i] = hit.Pos.z[lane];
+                Attribs[NormalX * Capacity + i] = hit.Normal.x[lane];
+                Attribs[NormalY * Capacity + i] = hit.Normal.y[lane];
+                Attribs[NormalZ * Capacity + i] = hit.Normal.z[lane];
+                MaterialData[i] = hit.MaterialData[lane];
+            }
+        }
+        // Loads hits for the packet starting at `offset`, `mask` is the mask of valid lanes from RayQueue::Load().
+        VHitResult Load(uint32_t offset, VMask mask) const {
+            const auto load = [&](Attrib attrib) { return VFloat::load(&Attribs[attrib * Capacity + offset]); };
+            VFloat dist = load(Distance);
+
+            return {
+                .MaterialData = VInt::load(&MaterialData[offset]),
+                .Distance = dist,
+                .Pos = { load(PosX), load(PosY), load(PosZ) },
+                .Normal = { load(NormalX), load(NormalY), load(NormalZ) },
+                .UV = 0.0f,
+                .Mask = mask & (dist >= 0.0f),
+                .NumIters = 0,
+                .NumSteps = 0,
+            };
+        }
+    };
+    RayQueue Queues[2];
+    RayQueue SortTemp;
+    HitQueue Hits;
+    std::vector<float> StartDists;  // Start distances of queued primary rays, in queue order
+    std::vector<uint64_t> SortKeys;
+    std::vector<float> Irradiance;  // 3 channels
+    std::vector<float> Noise;       // 2 channels per bounce, blue noise samples for bounce directions
+    std::vector<VInt> Albedo;       // per tile
+    std::vector<VFloat> Depth;      // per tile
+    std::vector<uint64_t> CacheKeys;     // Irradiance cache key of rays traced to add cache samples, or 0
+    std::vector<float> CacheIrradiance;  // 3 channels, radiance gathered after the first bounce by those rays
+    std::vector<float> FillThroughput;   // 3 channels, throughput of those rays at the first bounce
+    uint32_t NumPixels = 0;
+
+    void Resize(uint32_t numPixels, uint32_t numBounces) {
+        NumPixels = numPixels;
+        // Pad so that loads of partial packets at the end stay in bounds
+        uint32_t capacity = numPixels + simd::VectorWidth;
+
+        for (auto* queue : { &Queues[0], &Queues[1], &SortTemp }) {
+            if (queue->Capacity < capacity) {
+                queue->Attribs.resize(RayQueue::NumAttribs * capacity);
+                queue->PixelIndices.resize(capacity);
+                queue->Capacity = capacity;
+            }
+            queue->Count = 0;
+        }
+        if (Hits.Capacity < capacity) {
+            Hits.Attribs.resize(HitQueue::NumAttribs * capacity);
+            Hits.MaterialData.resize(capacity);
+            Hits.Capacity = capacity;
+        }
+        StartDists.resize(capacity);
+        Irradiance.resize(numPixels * 3);
+        Noise.resize(numPixels * 2 * numBounces);
+        Albedo.resize(numPixels / simd::VectorWidth);
+        Depth.resize(numPixels / simd::VectorWidth);
+        CacheKeys.resize(numPixels);
+        CacheIrradiance.resize(numPixels * 3);
+        FillThroughput.resize(numPixels * 3);
+    }
+};
+
+// Lanes are only refilled once at most this many are still traversing, as refills take a few
+// gathers and scalar stores that aren't worth paying for every single ray that terminates.
+static const uint32_t RefillMaxActiveLanes = simd::VectorWidth / 2;
+
+// Traces all rays in the queue with persistent lanes: instead of stepping each packet until its longest ray
+// terminates, terminated lanes are refilled with the next rays in the queue, so packets stay mostly full
+// until the queue runs out. Hits are written to `hits` in queue order.
+// Rays start at the distances in `startDists` (in queue order), or at the origin if null.
+[[gnu::noinline]]
+static void RayCastQueue(const FrameConstants& fc, const WavefrontScratch::RayQueue& queue, WavefrontScratch::HitQueue& hits,
+                         const TraversalSettings& settings, const float* startDists, TraversalCounters& counters) {
+    using RayAttrib = WavefrontScratch::RayQueue::Attrib;
+
+    RayTraversal ray;
+    VMask activeMask = 0;   // Lanes still traversing
+    VMask pendingMask = 0;  // Lanes that terminated, but whose hits haven't been stored yet
+    VMask hitMask = 0;
+    VInt rayIdx = 0, numLaneIters = 0;
+    uint32_t nextRayIdx = 0;
+
+    while (true) {
+        if (simd::popcnt(activeMask) <= RefillMaxActiveLanes && nextRayIdx < queue.Count) {
+            if (any(pendingMask)) {
+                hits.Store(pendingMask, rayIdx, ray.GetHit(fc.Storage, hitMask & pendingMask));
+            }
+            VMask freeMask = ~activeMask;
+            VInt newRayIdx = -1;
+
+            for (uint32_t lane : BitIter<uint32_t>(freeMask)) {
+                if (nextRayIdx >= queue.Count) break;
+                newRayIdx[lane] = (int32_t)nextRayIdx++;
+            }
+            VMask newMask = newRayIdx >= 0;
+
+            const auto load = [&](RayAttrib attrib) {
+                return VFloat::mask_gather(&queue.Attribs[attrib * queue.Capacity], newRayIdx, newMask);
+            };
+            VFloat3 origin = { load(RayAttrib::OriginX), load(RayAttrib::OriginY), load(RayAttrib::OriginZ) };
+            VFloat3 dir = { load(RayAttrib::DirX), load(RayAttrib::DirY), load(RayAttrib::DirZ) };
+            VFloat startDist = startDists != nullptr ? VFloat::mask_gather(startDists, newRayIdx, newMask) : 0.0f;
+
+            activeMask |= ray.Begin(fc.Storage, newMask, origin, dir, fc.WorldOrigin, startDist);
+            pendingMask = newMask & ~activeMask;  // rays that missed the storage window
+            hitMask &= ~newMask;
+            rayIdx.set_if(newMask, newRayIdx);
+            numLaneIters.set_if(newMask, 0);
+        }
+        if (!any(activeMask)) {
+            if (nextRayIdx < queue.Count) continue;
+            break;
+        }
+        VMask coarseMask = 0;
+        if (settings.CoarseThreshold != 0) {
+            coarseMask = (numLaneIters >= (int32_t)settings.CoarseThreshold) | (ray.CurrDist >= (float)settings.CoarseThreshold);
+        }
+        VMask prevActiveMask = activeMask;
+        VMask stepHitMask = ray.Step(fc.Storage, activeMask, coarseMask, fc.WorldOrigin, settings);
+        counters.NumIters += simd::popcnt(activeMask | stepHitMask);
+        counters.NumSteps++;
+
+        hitMask |= stepHitMask;
+        numLaneIters += 1;
+        activeMask &= numLaneIters < (int32_t)MaxTraversalIters;
+        pendingMask |= prevActiveMask & ~activeMask;
+    }
+    if (any(pendingMask)) {
+        hits.Store(pendingMask, rayIdx, ray.GetHit(fc.Storage, hitMask & pendingMask));
+    }
+}
+
+// Renders the given block one bounce at a time. Rays that survive each bounce are compacted into a queue
+// and traced in full packets on the next one, instead of keeping dead lanes around like RenderRow().
+[[gnu::noinline]]
+static void RenderBlockWavefront(const FrameConstants& fc, Framebuffer* fb, WavefrontScratch& scratch, glm::uvec2 start, glm::uvec2 end, TraversalCounters& counters,
+                                 IrradianceCache::SampleBuffer* cacheSamples) {
+    constexpr swr::SamplerDesc SD = {
+        .MagFilter = swr::FilterMode::Nearest,
+        .MinFilter = swr::FilterMode::Nearest,
+        .EnableMips = true,
+    };
+    uint32_t tilesX = (end.x - start.x) / simd::TileWidth;
+    uint32_t tilesY = (end.y - start.y) / simd::TileHeight;
+    uint32_t numPixels = tilesX * tilesY * simd::VectorWidth;
+    scratch.Resize(numPixels, fc.NumLightBounces);
+
+    float* irradianceBuf[3] = { &scratch.Irradiance[0], &scratch.Irradiance[numPixels], &scratch.Irradiance[numPixels * 2] };
+    float* cacheIrradianceBuf[3] = { &scratch.CacheIrradiance[0], &scratch.CacheIrradiance[numPixels], &scratch.CacheIrradiance[numPixels * 2] };
+    float* fillThroughputBuf[3] = { &scratch.FillThroughput[0], &scratch.FillThroughput[numPixels], &scratch.FillThroughput[numPixels * 2] };
+
+    if (fc.Cache != nullptr) {
+        std::fill(scratch.CacheKeys.begin(), scratch.CacheKeys.end(), 0);
+        std::fill(scratch.CacheIrradiance.begin(), scratch.CacheIrradiance.end(), 0.0f);
+    }
+
+    // Primary rays are coherent, so they are traced directly in tiles. With persistent lanes, they are first
+    // queued in pixel order and traced in one go, so that lanes of rays that hit early are refilled too.
+    if (fc.UsePersistentLanes) {
+        auto& queue = scratch.Queues[1];  // Queues[0] collects first bounce rays below
+
+        for (uint32_t ty = 0; ty < tilesY; ty++) {
+            for (uint32_t tx = 0; tx < tilesX; tx++) {
+                uint32_t x = start.x + tx * simd::TileWidth;
+                uint32_t y = start.y + ty * simd::TileHeight;
+                uint32_t basePixelIdx = (tx + ty * tilesX) * simd::VectorWidth;
+
+                VFloat u = simd::conv2f((int32_t)x + simd::TileOffsetsX) + 0.5f;
+                VFloat v = simd::conv2f((int32_t)y + simd::TileOffsetsY) + 0.5f;
+
+                VFloat3 origin, dir;
+                GetPrimaryRay({ u, v }, fc.InvProj, origin, dir);
+                origin += VFloat3(fc.OriginFrac);
+
+                queue.Push((VMask)(~0), origin, dir, 1.0f, (int32_t)basePixelIdx + simd::LaneIdx);
+                GetPrimaryStartDist(fc, x, y).store(&scratch.StartDists[basePixelIdx]);
+            }
+        }
+        TraversalCounters primaryCounters;
+        RayCastQueue(fc, queue, scratch.Hits, fc.PrimaryTraversal, scratch.StartDists.data(), primaryCounters);
+
+        counters.NumIters += primaryCounters.NumIters;
+        counters.NumSteps += primaryCounters.NumSteps;
+        counters.NumPrimaryIters += primaryCounters.NumIters;
+        counters.NumPrimarySteps += primaryCounters.NumSteps;
+    }
+
+    for (uint32_t ty = 0; ty < tilesY; ty++) {
+        for (uint32_t tx = 0; tx < tilesX; tx++) {
+            uint32_t x = start.x + tx * simd::TileWidth;
+            uint32_t y = start.y + ty * simd::TileHeight;
+            uint32_t tileIdx = tx + ty * tilesX;
+            uint32_t basePixelIdx = tileIdx * simd::VectorWidth;
+
+            VFloat u = simd::conv2f((int32_t)x + simd::TileOffsetsX) + 0.5f;
+            VFloat v = simd::conv2f((int32_t)y + simd::TileOffsetsY) + 0.5f;
+
+            VFloat3 origin, dir;
+            GetPrimaryRay({ u, v }, fc.InvProj, origin, dir);
+            origin += VFloat3(fc.OriginFrac);
+
+            VHitResult hit;
+            if (fc.UsePersistentLanes) {
+                // Traversal counters for the queue were already taken above, only restarts are counted here
+                hit = scratch.Hits.Load(basePixelIdx, (VMask)(~0));
+                RestartFirstStepHits(fc, origin, dir, GetPrimaryStartDist(fc, x, y), hit);
+            } else {
+                hit = RayCastPrimary(fc, origin, dir, (VMask)(~0), x, y);
+            }
+            counters.NumRays += simd::VectorWidth;
+            counters.NumIters += hit.NumIters;
+            counters.NumSteps += hit.NumSteps;
+            counters.NumPrimaryRays += simd::VectorWidth;
+            counters.NumPrimaryIters += hit.NumIters;
+            counters.NumPrimarySteps += hit.NumSteps;
+            StorePrimaryDists(fc, x, y, hit);
+
+            VFloat3 irradiance = 0.0f;
+            VMask missMask = ~hit.Mask;
+
+            if (any(missMask)) {
+                // Special primary ray to prevent banding
+                VFloat3 skyColor = _skyBox.SampleCube<SD, false>(dir, 1);
+                irradiance.x.set_if(missMask, skyColor.x * 3);
+                irradiance.y.set_if(missMask, skyColor.y * 3);
+                irradiance.z.set_if(missMask, skyColor.z * 3);
+            }
+            VInt albedo = swr::pixfmt::RGBA8u::Pack({ hit.GetColor(), 0.0f });
+            albedo |= (round2i(hit.Normal.x) + 1) << 24;
+            albedo |= (round2i(hit.Normal.y) + 1) << 26;
+            albedo |= (round2i(hit.Normal.z) + 1) << 28;
+            scratch.Albedo[tileIdx] = albedo;
+
+            VFloat4 projPos = simd::TransformVector(fc.CurrentProj, { hit.Pos / 16.0f, 1.0f });  // scale down by 1/16 to minimize precision loss
+            scratch.Depth[tileIdx] = csel(missMask, -1.0f, projPos.z / projPos.w);
+
+            VFloat emissionStrength = hit.GetEmissionStrength();
+            StorePrimaryEmission(fc, x, y, hit, emissionStrength);
+
+            irradiance += emissionStrength;
+            irradiance.x.store(&irradianceBuf[0][basePixelIdx]);
+            irradiance.y.store(&irradianceBuf[1][basePixelIdx]);
+            irradiance.z.store(&irradianceBuf[2][basePixelIdx]);
+
+            // Blue noise is tiled by packet, so samples for later bounces must be taken before rays are regrouped.
+            for (uint32_t i = 1; i < fc.NumLightBounces; i++) {
+                VFloat2 bn = _blueNoise.Sample(glm::uvec2(x, y), fc.FrameNo, i);
+                bn.x.store(&scratch.Noise[(i * 2 + 0) * numPixels + basePixelIdx]);
+                bn.y.store(&scratch.Noise[(i * 2 + 1) * numPixels + basePixelIdx]);
+            }
+            VMask bounceMask = hit.Mask & GetLightingMask(fc, x, y);
+
+            if (any(bounceMask)) {
+                VFloat2 bn = _blueNoise.Sample(glm::uvec2(x, y), fc.FrameNo, 0);
+                VFloat3 bounceOrigin = hit.Pos + hit.Normal * 0.01f;
+                VFloat3 bounceDir = simd::normalize(hit.Normal + SampleDirection(bn));  // lambertian
+
+                scratch.Queues[0].Push(bounceMask, bounceOrigin, bounceDir, 1.0f, (int32_t)basePixelIdx + simd::LaneIdx);
+            }
+        }
+    }
+
+    for (uint32_t i = 1; i <= fc.NumLightBounces; i++) {
+        auto& srcQueue = scratch.Queues[(i - 1) & 1];
+        auto& dstQueue = scratch.Queues[i & 1];
+        dstQueue.Count = 0;
+
+        // Rays past the first bounce are only traced for cache samples, if the cache is enabled
+        float* const* radianceBuf = fc.Cache != nullptr && i >= 2 ? cacheIrradianceBuf : irradianceBuf;
+
+        if (fc.SortBounceRays && srcQueue.Count > simd::VectorWidth) {
+            srcQueue.SortForCoherence(scratch.SortTemp, scratch.SortKeys);
+        }
+        if (fc.UsePersistentLanes) {
+            RayCastQueue(fc, srcQueue, scratch.Hits, fc.BounceTraversal, nullptr, counters);
+        }
+
+        for (uint32_t j = 0; j < srcQueue.Count; j += simd::VectorWidth) {
+            VFloat3 origin, dir, throughput;
+            VInt pixelIdx;
+            VMask mask = srcQueue.Load(j, origin, dir, throughput, pixelIdx);
+
+            // Traversal counters for persistent lanes were already taken by RayCastQueue()
+            auto hit = fc.UsePersistentLanes ? scratch.Hits.Load(j, mask)
+                                             : RayCast(fc.Storage, origin, dir, mask, fc.WorldOrigin, fc.BounceTraversal);
+            counters.NumRays += simd::popcnt(mask);
+            counters.NumIters += hit.NumIters;
+            counters.NumSteps += hit.NumSteps;
+
+            VFloat3 matColor = hit.GetColor();
+            VFloat emissionStrength = hit.GetEmissionStrength();
+
+            VMask missMask = mask & ~hit.Mask;
+            if (any(missMask)) {
+                VFloat3 skyColor = _skyBox.SampleCube<SD, false>(dir, 3);
+                matColor.x.set_if(missMask, skyColor.x * 3);
+                matColor.y.set_if(missMask, skyColor.y * 3);
+                matColor.z.set_if(missMask, skyColor.z * 3);
+                emissionStrength.set_if(missMask, 1.0f);
+            }
+            throughput *= matColor;
+            VFloat3 radiance = throughput * emissionStrength;
+
+            for (uint32_t lane : BitIter<uint32_t>(mask)) {
+                uint32_t p = (uint32_t)pixelIdx[lane];
+                radianceBuf[0][p] += radiance.x[lane];
+                radianceBuf[1][p] += radiance.y[lane];
+                radianceBuf[2][p] += radiance.z[lane];
+            }
+
+            VMask bounceMask = mask & hit.Mask;
+
+            if (i == 1 && fc.Cache != nullptr && any(bounceMask)) {
+                // Rays with cached irradiance stop here, the others continue with throughput relative to this hit.
+                VInt pixelSeed = pixelIdx + (int32_t)(start.x + start.y * fc.Size.x);
+                uint64_t keys[simd::VectorWidth];
+                VFloat3 cachedIrradiance;
+                VMask cachedMask = fc.Cache->Lookup(fc, hit, bounceMask, pixelSeed, keys, cachedIrradiance);
+                counters.NumCacheLookups += simd::popcnt(bounceMask);
+                counters.NumCacheHits += simd::popcnt(cachedMask);
+
+                VFloat3 cachedRadiance = throughput * cachedIrradiance;
+                for (uint32_t lane : BitIter<uint32_t>(cachedMask)) {
+                    uint32_t p = (uint32_t)pixelIdx[lane];
+                    irradianceBuf[0][p] += cachedRadiance.x[lane];
+                    irradianceBuf[1][p] += cachedRadiance.y[lane];
+                    irradianceBuf[2][p] += cachedRadiance.z[lane];
+                }
+                bounceMask &= ~cachedMask;
+
+                for (uint32_t lane : BitIter<uint32_t>(bounceMask)) {
+                    uint32_t p = (uint32_t)pixelIdx[lane];
+                    scratch.CacheKeys[p] = keys[lane];
+                    fillThroughputBuf[0][p] = throughput.x[lane];
+                    fillThroughputBuf[1][p] = throughput.y[lane];
+                    fillThroughputBuf[2][p] = throughput.z[lane];
+                }
+                throughput = 1.0f;
+            }
+            if (i < fc.NumLightBounces && any(bounceMask)) {
+                VFloat2 bn = {
+                    VFloat::mask_gather(&scratch.Noise[(i * 2 + 0) * numPixels], pixelIdx, bounceMask),
+                    VFloat::mask_gather(&scratch.Noise[(i * 2 + 1) * numPixels], pixelIdx, bounceMask),
+                };
+                VFloat3 bounceOrigin = hit.Pos + hit.Normal * 0.01f;
+                VFloat3 bounceDir = simd::normalize(hit.Normal + SampleDirection(bn));
+
+                dstQueue.Push(bounceMask, bounceOrigin, bounceDir, throughput, pixelIdx);
+            }
+        }
+    }
+
+    if (fc.Cache != nullptr) {
+        for (uint32_t p = 0; p < numPixels; p++) {
+            if (scratch.CacheKeys[p] == 0) continue;
+
+            glm::vec3 sample = { cacheIrradianceBuf[0][p], cacheIrradianceBuf[1][p], cacheIrradianceBuf[2][p] };
+            irradianceBuf[0][p] += fillThroughputBuf[0][p] * sample.x;
+            irradianceBuf[1][p] += fillThroughputBuf[1][p] * sample.y;
+            irradianceBuf[2][p] += fillThroughputBuf[2][p] * sample.z;
+            cacheSamples->Add(scratch.CacheKeys[p], sample);
+        }
+    }
+
+    for (uint32_t ty = 0; ty < tilesY; ty++) {
+        uint32_t y = start.y + ty * simd::TileHeight;
+        auto dest = &fb->Tiles[(y >> fb->TileShiftY) * fb->TileStride + (start.x >> fb->TileShiftX)];
+
+        for (uint32_t tx = 0; tx < tilesX; tx++) {
+            uint32_t tileIdx = tx + ty * tilesX;
+            uint32_t basePixelIdx = tileIdx * simd::VectorWidth;
+            VFloat3 irradiance = {
+                VFloat::load(&irradianceBuf[0][basePixelIdx]),
+                VFloat::load(&irradianceBuf[1][basePixelIdx]),
+                VFloat::load(&irradianceBuf[2][basePixelIdx]),
+            };
+            *dest++ = {
+                .Albedo = scratch.Albedo[tileIdx],
+                .Depth = scratch.Depth[tileIdx],
+                .IrradianceRG = swr::pixfmt::RG16f::Pack({ irradiance.x, irradiance.y }),
+                .IrradianceBX = swr::pixfmt::RG16f::Pack({ irradiance.z }),
+            };
+        }
+    }
+}
+
+// Returns block coords (x | y << 16) in Z-order, so that the contiguous ranges initially
+// assigned to each pool worker are compact on screen and share more voxel data in cache.
+static std::vector<uint32_t> GetMortonOrderedBlocks(uint32_t countX, uint32_t countY) {
+    const auto spread2 = [](uint32_t v) {
+        v = (v | v << 8) & 0x00FF00FF;
+        v = (v | v << 4) & 0x0F0F0F0F;
+        v = (v | v << 2) & 0x33333333;
+        v = (v | v << 1) & 0x55555555;
+        return v;
+    };
+    std::vector<uint32_t> blocks;
+    blocks.reserve(countX * countY);
+
+    for (uint32_t y = 0; y < countY; y++) {
+        for (uint32_t x = 0; x < countX; x++) {
+            blocks.push_back(x | y << 16);
+        }
+    }
+    std::sort(blocks.begin(), blocks.end(), [&](uint32_t a, uint32_t b) {
+        uint32_t keyA = spread2(a & 0xFFFF) | spread2(a >> 16) << 1;
+        uint32_t keyB = spread2(b & 0xFFFF) | spread2(b >> 16) << 1;
+        return keyA < keyB;
+    });
+    return blocks;
+}
+
+CpuRenderer::CpuRenderer(ogl::ShaderLib& shlib, std::shared_ptr<VoxelMap> map) : CpuRenderer(std::move(map)) {
+    _gbuffer = std::make_unique<GBuffer>(shlib);
+    _blitShader = shlib.LoadComp("CopyTiledFramebuffer");
+}
+CpuRenderer::CpuRenderer(std::shared_ptr<VoxelMap> map) {
     _map = std::move(map);
     _storage = std::make_unique<FlatVoxelStorage>();
-    _gbuffer = std::make_unique<GBuffer>(shlib);
+    _threadPool = std::make_unique<glim::ThreadPool>();
 
-    _blitShader = shlib.LoadComp("CopyTiledFramebuffer");
+    for (uint32_t i = 0; i < _threadPool->GetNumWorkers(); i++) {
+        _wavefrontScratch.push_back(std::make_unique<WavefrontScratch>());
+    }
     _map->MarkAllDirty();
 }
 
 CpuRenderer::~CpuRenderer() = default;
 
+static size_t GetFramebufferSize(glm::uvec2 viewSize) {
+    uint32_t tilesX = viewSize.x / simd::TileWidth;
+    uint32_t tilesY = viewSize.y / simd::TileHeight;
+    return (tilesX * tilesY * sizeof(Framebuffer::Tile)) + sizeof(Framebuffer);
+}
+static void InitFramebuffer(Framebuffer* fb, glm::uvec2 viewSize) {
+    fb->Width = viewSize.x;
+    fb->Height = viewSize.y;
+    fb->TileStride = viewSize.x / simd::TileWidth;
+    fb->TileShiftX = (uint32_t)std::countr_zero(simd::TileWidth);
+    fb->TileShiftY = (uint32_t)std::countr_zero(simd::TileHeight);
+}
+
 void CpuRenderer::RenderFrame(glim::Camera& cam, glm::uvec2 viewSize) {
 #ifndef NDEBUG  // debug builds are slow af
-    viewSize /= 4;
+    if (!IsHeadless()) viewSize /= 4;
 #endif
     viewSize &= ~3u;  // round down to 4x4 steps
 
+    glm::uvec2 outputSize = viewSize;
+    if (!IsHeadless()) {
+        viewSize = _dynamicRes.Update(_frameTime.GetLastMs(), outputSize);
+    }
+
     bool worldChanged = _map->DirtyLocs.size() > 0;
-    _storage->SyncBuffers(*_map);
-    _gbuffer->SetCamera(cam, viewSize, worldChanged);
 
-    uint32_t tilesX = viewSize.x / simd::TileWidth;
-    uint32_t tilesY = viewSize.y / simd::TileHeight;
-    size_t fbSize = (tilesX * tilesY * sizeof(Framebuffer::Tile)) + sizeof(Framebuffer);
+    // Entries hold light from bounces after the first, so they need at least 2 and are stale if the count changes
+    if (!UseIrradianceCache || NumLightBounces < 2) {
+        _irradianceCache = nullptr;
+    } else if (_irradianceCache == nullptr || _irradianceCache->NumLightBounces != NumLightBounces) {
+        _irradianceCache = std::make_unique<IrradianceCache>(_threadPool->GetNumWorkers(), NumLightBounces);
+    } else if (worldChanged) {
+        _irradianceCache->Invalidate(*_map, *_threadPool);
+    }
+
+    auto syncStart = std::chrono::steady_clock::now();
+    _lastStats.NumSyncedBricks = _storage->SyncBuffers(*_map, cam.ViewPosition, *_threadPool);
+    _lastStats.SyncMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - syncStart).count();
+
+    _currentPos = cam.ViewPosition;
+    _currentProj = cam.GetProjMatrix() * cam.GetViewMatrix(false);
+    _frameNo++;
+
+    if (IsHeadless()) {
+        Framebuffer* fb = GetHostFramebuffer(viewSize);
+        RenderTiles(fb, viewSize);
+
+        _lastStats.DenoiseMs = 0;
+
+        if (NumDenoiserPasses > 0) {
+            if (_denoiser == nullptr) {
+                _denoiser = std::make_unique<CpuDenoiser>();
+            }
+            auto denoiseStart = std::chrono::steady_clock::now();
+            _denoiser->NumPasses = std::min(NumDenoiserPasses, CpuDenoiser::MaxPasses);
+            _denoiser->Denoise(*fb, _currentProj, _currentPos, worldChanged, *_threadPool);
+            _lastStats.DenoiseMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - denoiseStart).count();
+        }
+        return;
+    }
+    _gbuffer->SetCamera(cam, viewSize, outputSize, worldChanged);
+    _currentProj = _gbuffer->CurrentProj;  // includes upscaling jitter
 
     // Buffer orphaning is way faster than keeping a single one.
-    auto pbo = ogl::Buffer(fbSize, GL_DYNAMIC_STORAGE_BIT | GL_MAP_WRITE_BIT);
+    auto pbo = ogl::Buffer(GetFramebufferSize(viewSize), GL_DYNAMIC_STORAGE_BIT | GL_MAP_WRITE_BIT);
 
     // Writing to memory mapping is ~1ms slower than local buffer at 1080p,
     // but temp buffer + BufferSubData() is even slower... though probably faster for dGPUs?
     // auto fb = (Framebuffer*)_fbData.get();
     auto fb = pbo.Map<Framebuffer>(GL_MAP_WRITE_BIT);
-    fb->Width = viewSize.x;
-    fb->Height = viewSize.y;
-    fb->TileStride = viewSize.x / simd::TileWidth;
-    fb->TileShiftX = (uint32_t)std::countr_zero(simd::TileWidth);
-    fb->TileShiftY = (uint32_t)std::countr_zero(simd::TileHeight);
+    RenderTiles(fb.get(), viewSize);
+    fb.reset();
+
+    // Present
+    _gbuffer->SetUniforms(*_blitShader);
+    _blitShader->SetUniform("ssbo_FrameData", pbo);
+
+    uint32_t groupsX = (viewSize.x + 7) / 8, groupsY = (viewSize.y + 7) / 8;
+    _blitShader->DispatchCompute(groupsX, groupsY, 1);
+
+    _gbuffer->DenoiseAndPresent();
+}
+
+Framebuffer* CpuRenderer::GetHostFramebuffer(glm::uvec2 viewSize) {
+    size_t fbSize = GetFramebufferSize(viewSize);
+
+    if (_hostFramebufferSize < fbSize) {
+        _hostFramebuffer = simd::alloc_buffer<uint8_t>(fbSize);
+        _hostFramebufferSize = fbSize;
+    }
+    return (Framebuffer*)_hostFramebuffer.get();
+}
+
+void CpuRenderer::RenderTiles(Framebuffer* fb, glm::uvec2 viewSize) {
+    InitFramebuffer(fb, viewSize);
 
     _frameTime.Begin();
+    auto traceStart = std::chrono::steady_clock::now();
+
+    bool reducedLighting = BounceRayRate != LightingRate::Full && NumLightBounces > 0;
+    bool useCache = _irradianceCache != nullptr;
 
     FrameConstants fc = {
         .Storage = *_storage,
         .Size = viewSize,
-        .WorldOrigin = glm::floor(_gbuffer->CurrentPos),
-        .OriginFrac = glm::fract(_gbuffer->CurrentPos),
-        .FrameNo = _gbuffer->FrameNo,
-        .NumLightBounces = _numLightBounces,
-        .CurrentProj = _gbuffer->CurrentProj,
-        .InvProj = GBuffer::GetInverseProjScreenMat(_gbuffer->CurrentProj, viewSize),
+        .WorldOrigin = glm::floor(_currentPos),
+        .OriginFrac = glm::fract(_currentPos),
+        .FrameNo = _frameNo,
+        .NumLightBounces = NumLightBounces,
+        .SortBounceRays = SortBounceRays,
+        .UsePersistentLanes = UsePersistentLanes,
+        .PrimaryTraversal = {
+            .AnisotropicLods = UseAnisotropicLods,
+            .CacheStepMasks = CacheStepMasks,
+        },
+        .BounceTraversal = {
+            .AnisotropicLods = UseAnisotropicLods,
+            .CoarseThreshold = CoarseBounceRays ? CoarseBounceThreshold : 0,
+            .CacheStepMasks = CacheStepMasks,
+        },
+        .CurrentProj = _currentProj,
+        .InvProj = GBuffer::GetInverseProjScreenMat(_currentProj, viewSize),
+        .BeamDists = nullptr,
+        .ReuseDists = nullptr,
+        .PrimaryDists = nullptr,
+        .BounceRayRate = reducedLighting ? BounceRayRate : LightingRate::Full,
+        .PrimaryEmission = nullptr,
+        .Cache = useCache ? _irradianceCache.get() : nullptr,
     };
 
-    auto rows = std::ranges::iota_view(0u, viewSize.y / simd::TileHeight);
-    std::for_each(std::execution::par_unseq, rows.begin(), rows.end(), [&](uint32_t rowId) {
-        // VRandom rng(rowId + _gbuffer->FrameNo * 123456ull);
-        uint32_t y = rowId * simd::TileHeight;
-        auto tile = &fb->Tiles[(y / simd::TileHeight) * fb->TileStride];
+    uint32_t blocksX = (viewSize.x + BlockSize - 1) / BlockSize;
+    uint32_t blocksY = (viewSize.y + BlockSize - 1) / BlockSize;
 
-        RenderRow(fc, tile, y);
+    if (_blockOrderSize != glm::uvec2(blocksX, blocksY)) {
+        _blockOrder = GetMortonOrderedBlocks(blocksX, blocksY);
+        _blockOrderSize = glm::uvec2(blocksX, blocksY);
+    }
+    std::atomic_uint64_t numRays = 0, numIters = 0, numSteps = 0;
+    std::atomic_uint64_t numPrimaryRays = 0, numPrimaryIters = 0, numPrimarySteps = 0, numBeamIters = 0;
+    std::atomic_uint64_t numCacheLookups = 0, numCacheHits = 0;
+    bool useWavefront = UseWavefront && NumLightBounces > 0;
+
+    if (UseBeamPrepass) {
+        uint32_t cellsX = (viewSize.x + BeamSize - 1) / BeamSize;
+        uint32_t cellsY = (viewSize.y + BeamSize - 1) / BeamSize;
+        _beamDists.resize(cellsX * cellsY);
+        fc.BeamDists = _beamDists.data();
+
+        // Cone steps are scalar, so they are only counted in the beam stats
+        _threadPool->ParallelFor(cellsY, [&](uint32_t y, uint32_t workerIdx) {
+            TraversalCounters counters;
+            TraceBeamRow(fc, &_beamDists[y * cellsX], y, cellsX, counters);
+
+            numBeamIters.fetch_add(counters.NumIters, std::memory_order_relaxed);
+        });
+    }
+
+    // Previous depths are only valid if the world hasn't changed since, and the camera didn't move too far
+    bool canReuseDepth = UseDepthReuse && _prevViewSize == viewSize && _lastStats.NumSyncedBricks == 0 &&
+                         glm::distance(_prevPos, _currentPos) <= MaxReuseTranslation;
+    uint32_t numReusedCells = 0;
+
+    if (canReuseDepth) {
+        uint32_t cellsX = (viewSize.x + BeamSize - 1) / BeamSize;
+        uint32_t cellsY = (viewSize.y + BeamSize - 1) / BeamSize;
+        _reprojectedDists.assign(viewSize.x * viewSize.y, std::bit_cast<uint32_t>(INFINITY));
+        _reuseDists.resize(cellsX * cellsY);
+
+        glm::mat4 currProj = glm::inverse(fc.InvProj);
+        glm::vec3 posDelta = glm::vec3(_prevPos - _currentPos);
+
+        _threadPool->ParallelFor(viewSize.y / simd::TileHeight, [&](uint32_t tileY, uint32_t workerIdx) {
+            const float* prevDists = &_primaryDists[tileY * (viewSize.x / simd::TileWidth) * simd::VectorWidth];
+            ReprojectPrimaryDists(prevDists, _reprojectedDists.data(), tileY * simd::TileHeight, viewSize, _prevInvProj, currProj, posDelta);
+        });
+        _threadPool->ParallelFor(cellsY, [&](uint32_t cellY, uint32_t workerIdx) {
+            ReduceReprojectedDists(_reprojectedDists.data(), &_reuseDists[cellY * cellsX], cellY, viewSize, _frameNo);
+        });
+        fc.ReuseDists = _reuseDists.data();
+        numReusedCells = (uint32_t)std::count_if(_reuseDists.begin(), _reuseDists.end(), [](float dist) { return dist > 0; });
+    }
+    if (UseDepthReuse || reducedLighting) {
+        _primaryDists.resize(viewSize.x * viewSize.y);
+        fc.PrimaryDists = _primaryDists.data();
+    }
+    if (reducedLighting) {
+        _primaryEmission.resize(viewSize.x * viewSize.y);
+        fc.PrimaryEmission = _primaryEmission.data();
+    }
+
+    _threadPool->ParallelFor((uint32_t)_blockOrder.size(), [&](uint32_t itemIdx, uint32_t workerIdx) {
+        uint32_t startX = (_blockOrder[itemIdx] & 0xFFFF) * BlockSize;
+        uint32_t startY = (_blockOrder[itemIdx] >> 16) * BlockSize;
+        uint32_t endX = std::min(startX + BlockSize, viewSize.x);
+        uint32_t endY = std::min(startY + BlockSize, viewSize.y);
+
+        TraversalCounters counters;
+        auto cacheSamples = useCache ? &_irradianceCache->WorkerSamples[workerIdx] : nullptr;
+
+        if (useWavefront) {
+            RenderBlockWavefront(fc, fb, *_wavefrontScratch[workerIdx], { startX, startY }, { endX, endY }, counters, cacheSamples);
+        } else {
+            for (uint32_t y = startY; y < endY; y += simd::TileHeight) {
+                auto tile = &fb->Tiles[(y >> fb->TileShiftY) * fb->TileStride + (startX >> fb->TileShiftX)];
+                RenderRow(fc, tile, y, startX, endX, counters, cacheSamples);
+            }
+        }
+        numRays.fetch_add(counters.NumRays, std::memory_order_relaxed);
+        numIters.fetch_add(counters.NumIters, std::memory_order_relaxed);
+        numSteps.fetch_add(counters.NumSteps, std::memory_order_relaxed);
+        numPrimaryRays.fetch_add(counters.NumPrimaryRays, std::memory_order_relaxed);
+        numPrimaryIters.fetch_add(counters.NumPrimaryIters, std::memory_order_relaxed);
+        numPrimarySteps.fetch_add(counters.NumPrimarySteps, std::memory_order_relaxed);
+        numCacheLookups.fetch_add(counters.NumCacheLookups, std::memory_order_relaxed);
+        numCacheHits.fetch_add(counters.NumCacheHits, std::memory_order_relaxed);
     });
 
+    _blockWorkerStats.resize(_threadPool->GetNumWorkers());
+    for (uint32_t i = 0; i < _blockWorkerStats.size(); i++) {
+        _blockWorkerStats[i] = _threadPool->GetWorkerStats(i);
+    }
+
+    if (useCache) {
+        _irradianceCache->Merge(_frameNo, *_threadPool);
+    }
+    if (reducedLighting) {
+        _threadPool->ParallelFor(viewSize.y / simd::TileHeight, [&](uint32_t tileY, uint32_t workerIdx) { UpsampleLightingRow(fc, *fb, tileY); });
+    }
     _frameTime.End();
 
-    // Present
-    _gbuffer->SetUniforms(*_blitShader);
-    _blitShader->SetUniform("ssbo_FrameData", pbo);
+    _lastStats.TraceMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - traceStart).count();
+    _lastStats.NumRays = numRays;
+    _lastStats.NumTraversalIters = numIters;
+    _lastStats.NumTraversalSteps = numSteps;
+    _lastStats.NumPrimaryRays = numPrimaryRays;
+    _lastStats.NumPrimaryIters = numPrimaryIters;
+    _lastStats.NumPrimarySteps = numPrimarySteps;
+    _lastStats.NumBeamIters = numBeamIters;
+    _lastStats.DepthReuseRate = canReuseDepth ? numReusedCells / (double)_reuseDists.size() : 0.0;
+    _lastStats.IrradianceCacheHitRate = numCacheLookups > 0 ? numCacheHits / (double)numCacheLookups : 0.0;
+
+    _prevViewSize = UseDepthReuse ? viewSize : glm::uvec2(0);
+    _prevInvProj = fc.InvProj;
+    _prevPos = _currentPos;
+}
 
-    uint32_t groupsX = (viewSize.x + 7) / 8, groupsY = (viewSize.y + 7) / 8;
-    _blitShader->DispatchCompute(groupsX, groupsY, 1);
+CpuRenderer::AccumulationStats CpuRenderer::Accumulate(glim::Camera& cam, glm::uvec2 viewSize, const AccumulationParams& params) {
+    if (!IsHeadless()) {
+        throw std::logic_error("Accumulation is only supported in headless mode");
+    }
+    viewSize &= ~3u;
+    uint32_t samplesPerPass = std::max(params.SamplesPerPass, 1u);
+    uint32_t minSamples = std::max(params.MinSamples, 2u);  // variance needs at least two samples
 
-    _gbuffer->DenoiseAndPresent();
+    _lastStats = {};
+    _lastStats.NumSyncedBricks = _storage->SyncBuffers(*_map, cam.ViewPosition, *_threadPool);
+
+    _currentPos = cam.ViewPosition;
+    _currentProj = cam.GetProjMatrix() * cam.GetViewMatrix(false);
+
+    Framebuffer* fb = GetHostFramebuffer(viewSize);
+    InitFramebuffer(fb, viewSize);
+
+    FrameConstants fc = {
+        .Storage = *_storage,
+        .Size = viewSize,
+        .WorldOrigin = glm::floor(_currentPos),
+        .OriginFrac = glm::fract(_currentPos),
+        .FrameNo = _frameNo,
+        .NumLightBounces = NumLightBounces,
+        .SortBounceRays = SortBounceRays,
+        .UsePersistentLanes = UsePersistentLanes,
+        .PrimaryTraversal = {
+            .AnisotropicLods = UseAnisotropicLods,
+            .CacheStepMasks = CacheStepMasks,
+        },
+        .BounceTraversal = {
+            .AnisotropicLods = UseAnisotropicLods,
+            .CoarseThreshold = CoarseBounceRays ? CoarseBounceThreshold : 0,
+            .CacheStepMasks = CacheStepMasks,
+        },
+        .CurrentProj = _currentProj,
+        .InvProj = GBuffer::GetInverseProjScreenMat(_currentProj, viewSize),
+        .BeamDists = nullptr,
+        .ReuseDists = nullptr,
+        .PrimaryDists = nullptr,
+        .BounceRayRate = LightingRate::Full,
+        .PrimaryEmission = nullptr,
+        .Cache = nullptr,
+    };
+
+    // Per-pixel sums in framebuffer tile order
+    enum AccumPlane { SumR, SumG, SumB, SumLuma, SumLumaSq, NumAccumPlanes };
+    uint32_t numPixels = viewSize.x * viewSize.y;
+    std::vector<float> accum(numPixels * NumAccumPlanes, 0.0f);
+
+    const auto getPlane = [&](uint32_t x, uint32_t y, AccumPlane plane) {
+        uint32_t tileIdx = (y >> fb->TileShiftY) * fb->TileStride + (x >> fb->TileShiftX);
+        return &accum[plane * numPixels + tileIdx * simd::VectorWidth];
+    };
+
+    uint32_t blocksX = (viewSize.x + BlockSize - 1) / BlockSize;
+    uint32_t blocksY = (viewSize.y + BlockSize - 1) / BlockSize;
+    std::vector<uint32_t> pendingBlocks = GetMortonOrderedBlocks(blocksX, blocksY);
+    std::vector<uint32_t> blockSamples(blocksX * blocksY, 0);
+    std::vector<float> blockNoise(blocksX * blocksY, INFINITY);
+    std::vector<uint8_t> blockDone(blocksX * blocksY, 0);
+
+    std::atomic_uint64_t numRays = 0, numIters = 0, numSteps = 0;
+    std::atomic_bool allReachedTarget = true;
+    auto startTime = std::chrono::steady_clock::now();
+
+    // Each pass traces a few samples for all blocks that haven't converged yet, so that
+    // the thread pool only works on noisy blocks after the easy ones are done.
+    while (!pendingBlocks.empty()) {
+        _threadPool->ParallelFor((uint32_t)pendingBlocks.size(), [&](uint32_t itemIdx, uint32_t workerIdx) {
+            uint32_t blockX = pendingBlocks[itemIdx] & 0xFFFF;
+            uint32_t blockY = pendingBlocks[itemIdx] >> 16;
+            uint32_t blockIdx = blockX + blockY * blocksX;
+            uint32_t startX = blockX * BlockSize, endX = std::min(startX + BlockSize, viewSize.x);
+            uint32_t startY = blockY * BlockSize, endY = std::min(startY + BlockSize, viewSize.y);
+
+            TraversalCounters counters;
+
+            for (uint32_t i = 0; i < samplesPerPass; i++) {
+                // Every sample takes a different blue noise frame
+                FrameConstants sampleFc = fc;
+                sampleFc.FrameNo = fc.FrameNo + blockSamples[blockIdx] + i;
+
+                for (uint32_t y = startY; y < endY; y += simd::TileHeight) {
+                    auto tile = &fb->Tiles[(y >> fb->TileShiftY) * fb->TileStride + (startX >> fb->TileShiftX)];
+                    RenderRow(sampleFc, tile, y, startX, endX, counters, nullptr);
+
+                    for (uint32_t x = startX; x < endX; x += simd::TileWidth, tile++) {
+                        VFloat2 irradianceRG = swr::pixfmt::RG16f::Unpack(tile->IrradianceRG);
+                        VFloat irradianceB = swr::pixfmt::RG16f::Unpack(tile->IrradianceBX).x;
+                        VFloat luma = irradianceRG.x * 0.299f + irradianceRG.y * 0.587f + irradianceB * 0.114f;
+
+                        const auto add = [&](AccumPlane plane, VFloat value) {
+                            float* ptr = getPlane(x, y, plane);
+                            (VFloat::load(ptr) + value).store(ptr);
+                        };
+                        add(SumR, irradianceRG.x);
+                        add(SumG, irradianceRG.y);
+                        add(SumB, irradianceB);
+                        add(SumLuma, luma);
+                        add(SumLumaSq, luma * luma);
+                    }
+                }
+            }
+            blockSamples[blockIdx] += samplesPerPass;
+            uint32_t numSamples = blockSamples[blockIdx];
+
+            // RMS standard error of the mean luminance, relative to the block's mean luminance,
+            // so that dark and bright regions converge to about the same visual quality.
+            float n = (float)numSamples, rcpN = 1.0f / n;
+            VFloat sumVariance = 0.0f, sumMean = 0.0f;
+
+            for (uint32_t y = startY; y < endY; y += simd::TileHeight) {
+                for (uint32_t x = startX; x < endX; x += simd::TileWidth) {
+                    VFloat mean = VFloat::load(getPlane(x, y, SumLuma)) * rcpN;
+                    VFloat meanSq = VFloat::load(getPlane(x, y, SumLumaSq)) * rcpN;
+                    sumVariance += max(meanSq - mean * mean, 0.0f);
+                    sumMean += mean;
+                }
+            }
+            float totalVariance = 0.0f, totalMean = 0.0f;
+            for (uint32_t i = 0; i < simd::VectorWidth; i++) {
+                totalVariance += sumVariance[i];
+                totalMean += sumMean[i];
+            }
+            float numBlockPixels = (float)((endX - startX) * (endY - startY));
+            float variance = totalVariance / numBlockPixels * (n > 1 ? n / (n - 1) : 0.0f);  // unbiased
+            float noise = std::sqrt(variance * rcpN) / std::max(totalMean / numBlockPixels, 0.001f);
+            blockNoise[blockIdx] = noise;
+
+            bool converged = numSamples >= minSamples && noise <= params.TargetNoise;
+            if (converged || numSamples >= params.MaxSamples) {
+                blockDone[blockIdx] = 1;
+            }
+            if (!converged && numSamples >= params.MaxSamples) {
+                allReachedTarget.store(false, std::memory_order_relaxed);
+            }
+            numRays.fetch_add(counters.NumRays, std::memory_order_relaxed);
+            numIters.fetch_add(counters.NumIters, std::memory_order_relaxed);
+            numSteps.fetch_add(counters.NumSteps, std::memory_order_relaxed);
+        });
+        std::erase_if(pendingBlocks, [&](uint32_t block) { return blockDone[(block & 0xFFFF) + (block >> 16) * blocksX] != 0; });
+    }
+    double elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+
+    // Resolve mean irradiance into the framebuffer. Albedo and depth are the same for all samples.
+    _threadPool->ParallelFor(viewSize.y / simd::TileHeight, [&](uint32_t tileY, uint32_t workerIdx) {
+        uint32_t y = tileY * simd::TileHeight;
+        auto tile = &fb->Tiles[tileY * fb->TileStride];
+
+        for (uint32_t x = 0; x < viewSize.x; x += simd::TileWidth, tile++) {
+            float rcpN = 1.0f / (float)blockSamples[x / BlockSize + (y / BlockSize) * blocksX];
+            VFloat r = VFloat::load(getPlane(x, y, SumR)) * rcpN;
+            VFloat g = VFloat::load(getPlane(x, y, SumG)) * rcpN;
+            VFloat b = VFloat::load(getPlane(x, y, SumB)) * rcpN;
+
+            tile->IrradianceRG = swr::pixfmt::RG16f::Pack({ r, g });
+            tile->IrradianceBX = swr::pixfmt::RG16f::Pack({ b });
+        }
+    });
+
+    AccumulationStats stats = {
+        .ElapsedMs = elapsedMs,
+        .TimeToTargetMs = allReachedTarget ? elapsedMs : -1.0,
+        .NumTiles = blocksX * blocksY,
+    };
+    for (uint32_t blockY = 0; blockY < blocksY; blockY++) {
+        for (uint32_t blockX = 0; blockX < blocksX; blockX++) {
+            uint32_t blockIdx = blockX + blockY * blocksX;
+            uint32_t numBlockPixels = (std::min((blockX + 1) * BlockSize, viewSize.x) - blockX * BlockSize) *
+                                      (std::min((blockY + 1) * BlockSize, viewSize.y) - blockY * BlockSize);
+
+            stats.NumSamples += (uint64_t)blockSamples[blockIdx] * numBlockPixels;
+            stats.MaxSamplesPerPixel = std::max(stats.MaxSamplesPerPixel, blockSamples[blockIdx]);
+            stats.NumConvergedTiles += blockNoise[blockIdx] <= params.TargetNoise;
+            stats.MaxNoise = std::max(stats.MaxNoise, (double)blockNoise[blockIdx]);
+        }
+    }
+    stats.SamplesPerSec = elapsedMs > 0 ? stats.NumSamples / (elapsedMs / 1000.0) : 0.0;
+    stats.NumRays = numRays;
+
+    _lastStats.TraceMs = elapsedMs;
+    _lastStats.NumRays = numRays;
+    _lastStats.NumTraversalIters = numIters;
+    _lastStats.NumTraversalSteps = numSteps;
+    _frameNo += stats.MaxSamplesPerPixel;
+
+    return stats;
+}
+
+// Calls `fn(x, y, albedo, irradiance)` for each pixel in the given tiled framebuffer.
+template<typename F>
+static void DetileFramebuffer(const Framebuffer& fb, F fn) {
+    for (uint32_t ty = 0; ty < fb.Height; ty += simd::TileHeight) {
+        for (uint32_t tx = 0; tx < fb.Width; tx += simd::TileWidth) {
+            const Framebuffer::Tile& tile = fb.Tiles[(ty >> fb.TileShiftY) * fb.TileStride + (tx >> fb.TileShiftX)];
+
+            for (uint32_t i = 0; i < simd::VectorWidth; i++) {
+                uint32_t albedo = (uint32_t)tile.Albedo[i];
+                glm::vec2 irradianceRG = glm::unpackHalf2x16((uint32_t)tile.IrradianceRG[i]);
+                glm::vec2 irradianceBX = glm::unpackHalf2x16((uint32_t)tile.IrradianceBX[i]);
+
+                // Same as CopyTiledFramebuffer.comp
+                glm::vec3 albedoColor = tile.Depth[i] < 0 ? glm::vec3(1.0f) : glm::vec3(glm::unpackUnorm4x8(albedo));
+
+                fn(tx + i % simd::TileWidth, ty + i / simd::TileWidth, albedoColor, glm::vec3(irradianceRG, irradianceBX.x));
+            }
+        }
+    }
+}
+
+// Same as GBufferBlit.frag
+static glm::vec3 TonemapAcesApprox(glm::vec3 v) {
+    v *= 0.6f;
+    float a = 2.51f;
+    float b = 0.03f;
+    float c = 2.43f;
+    float d = 0.59f;
+    float e = 0.14f;
+    return glm::clamp((v * (a * v + b)) / (v * (c * v + d) + e), 0.0f, 1.0f);
 }
+
+swr::StbImage CpuRenderer::GetColorImage() const {
+    auto fb = (const Framebuffer*)_hostFramebuffer.get();
+    if (fb == nullptr) {
+        throw std::logic_error("No headless frame has been rendered");
+    }
+    auto image = swr::StbImage::Create(fb->Width, fb->Height);
+    uint32_t* pixels = (uint32_t*)image.Data.get();
+
+    DetileFramebuffer(*fb, [&](uint32_t x, uint32_t y, glm::vec3 albedo, glm::vec3 irradiance) {
+        glm::vec3 color = TonemapAcesApprox(albedo * irradiance * 0.48f);
+        color = glm::pow(color, glm::vec3(0.45f));
+
+        // Flip vertically, framebuffer rows start at the bottom like in GL.
+        pixels[x + (fb->Height - 1 - y) * fb->Width] = glm::packUnorm4x8(glm::vec4(color, 1.0f));
+    });
+    return image;
+}
+swr::StbImage CpuRenderer::GetRadianceImage() const {
+    auto fb = (const Framebuffer*)_hostFramebuffer.get();
+    if (fb == nullptr) {
+        throw std::logic_error("No headless frame has been rendered");
+    }
+    auto image = swr::StbImage::Create(fb->Width, fb->Height, swr::StbImage::PixelType::RGB_F32);
+    glm::vec3* pixels = (glm::vec3*)image.Data.get();
+
+    DetileFramebuffer(*fb, [&](uint32_t x, uint32_t y, glm::vec3 albedo, glm::vec3 irradiance) {
+        pixels[x + (fb->Height - 1 - y) * fb->Width] = albedo * irradiance;
+    });
+    return image;
+}
+
 void CpuRenderer::DrawSettings(glim::SettingStore& settings) {
     ImGui::SeparatorText("Renderer##CPU");
     ImGui::PushItemWidth(150);
-    settings.Combo("Debug Channel", &_gbuffer->DebugChannelView);
-    settings.Slider("Light Bounces", &_numLightBounces, 1, 0u, 5u);
-    settings.Slider("Denoiser Passes", &_gbuffer->NumDenoiserPasses, 1, 0u, 5u);
+    settings.Slider("Light Bounces", &NumLightBounces, 1, 0u, 5u);
+    settings.Checkbox("Anisotropic LODs", &UseAnisotropicLods);
+    settings.Checkbox("Cache Step Masks", &CacheStepMasks);
+    settings.Checkbox("Beam Prepass", &UseBeamPrepass);
+    settings.Checkbox("Depth Reuse", &UseDepthReuse);
+    settings.Checkbox("Coarse Bounce Rays", &CoarseBounceRays);
+
+    if (CoarseBounceRays) {
+        settings.Slider("Coarse Threshold", &CoarseBounceThreshold, 1, 1u, 128u);
+    }
+    settings.Combo("Bounce Ray Rate", &BounceRayRate);
+    settings.Checkbox("Irradiance Cache", &UseIrradianceCache);
+
+    if (UseIrradianceCache && NumLightBounces < 2) {
+        ImGui::Text("Irradiance cache needs 2+ light bounces, inactive");
+    }
+    settings.Checkbox("Wavefront Tracing", &UseWavefront);
+
+    if (UseWavefront) {
+        settings.Checkbox("Sort Bounce Rays", &SortBounceRays);
+        settings.Checkbox("Persistent Lanes", &UsePersistentLanes);
+    }
+
+    if (!IsHeadless()) {
+        settings.Combo("Debug Channel", &_gbuffer->DebugChannelView);
+        settings.Slider("Denoiser Passes", &_gbuffer->NumDenoiserPasses, 1, 0u, 5u);
+        _dynamicRes.DrawSettings(settings);
+    } else {
+        settings.Slider("Denoiser Passes", &NumDenoiserPasses, 1, 0u, CpuDenoiser::MaxPasses);
+    }
     ImGui::PopItemWidth();
 
     ImGui::Separator();
     _frameTime.Draw("Frame Time");
 
-    if (_gbuffer->AlbedoTex != nullptr) {
+    if (_lastStats.NumRays > 0) {
         double frameMs, frameDevMs;
         _frameTime.GetElapsedMs(frameMs, frameDevMs);
 
-        uint32_t numPixels = _gbuffer->AlbedoTex->Width * _gbuffer->AlbedoTex->Height;
-        uint32_t raysPerPixel = _numLightBounces + 1;
-        double raysPerSec = numPixels * raysPerPixel * (1000 / frameMs);
+        double raysPerSec = _lastStats.NumRays * (1000 / frameMs);
+        double itersPerRay = _lastStats.NumTraversalIters / (double)_lastStats.NumRays;
+
+        ImGui::Text("Rays/sec: %.2fM (%.1f iters/ray)", raysPerSec / 1000000.0, itersPerRay);
+
+        double laneUtilization = _lastStats.NumTraversalIters / (double)(_lastStats.NumTraversalSteps * simd::VectorWidth);
+        ImGui::Text("Lane Utilization: %.1f%%", laneUtilization * 100);
 
-        ImGui::Text("Rays/sec: %.2fM", raysPerSec / 1000000.0);
+        double primaryItersPerRay = _lastStats.NumPrimaryIters / (double)_lastStats.NumPrimaryRays;
+        double beamItersPerRay = _lastStats.NumBeamIters / (double)_lastStats.NumPrimaryRays;
+        double primaryLaneUtilization = _lastStats.NumPrimaryIters / (double)(_lastStats.NumPrimarySteps * simd::VectorWidth);
+        ImGui::Text("Primary: %.1f iters/ray (+%.2f beam), %.1f%% lanes", primaryItersPerRay, beamItersPerRay, primaryLaneUtilization * 100);
+
+        if (UseDepthReuse) {
+            ImGui::Text("Depth Reuse: %.1f%% of cells", _lastStats.DepthReuseRate * 100);
+        }
+        if (_irradianceCache != nullptr) {
+            ImGui::Text("Irradiance Cache: %.1f%% hits", _lastStats.IrradianceCacheHitRate * 100);
+        }
+    }
+
+    size_t committedBytes = _storage->NumCommittedSectors * (FlatVoxelStorage::SectorStorageSize + FlatVoxelStorage::SectorOccupancySize);
+    ImGui::Text("Storage: %.1fMB committed (%u sectors)", committedBytes / 1048576.0, _storage->NumCommittedSectors.load());
+
+    if (ImGui::TreeNode("Thread Stats")) {
+        for (uint32_t i = 0; i < _blockWorkerStats.size(); i++) {
+            auto& stats = _blockWorkerStats[i];
+            ImGui::Text("#%-2d %6.2fms  %4d blocks  %3d steals", i, stats.BusyMs, stats.NumItems, stats.NumSteals);
+        }
+        ImGui::TreePop();
     }
 }
\ No newline at end of file
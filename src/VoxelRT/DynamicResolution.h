@@ -0,0 +1,54 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+
+#include <glm/glm.hpp>
+#include <imgui.h>
+#include <Common/SettingStore.h>
+
+// Adjusts the internal render resolution to keep frame times within a budget.
+// Render cost is assumed to be roughly proportional to the number of pixels.
+struct DynamicResolution {
+    bool Enabled = false;
+    float TargetFrameMs = 33.3f;
+    float MinScale = 0.5f;  // Lowest render resolution, as a fraction of the output resolution per axis
+
+    // Returns the render size for the next frame, given the time taken by the last one.
+    glm::uvec2 Update(double lastFrameMs, glm::uvec2 outputSize) {
+        if (!Enabled) {
+            _scale = _smoothScale = 1.0f;
+            return outputSize;
+        }
+        if (lastFrameMs > 0) {
+            float idealScale = _scale * std::sqrt(TargetFrameMs / (float)lastFrameMs);
+
+            // Drop quickly on spikes, but recover slowly so that we don't oscillate around the budget
+            float rate = idealScale < _smoothScale ? 0.5f : 0.1f;
+            _smoothScale = std::clamp(_smoothScale + (idealScale - _smoothScale) * rate, MinScale, 1.0f);
+        }
+        // Only switch between discrete levels, every change reallocates render targets and resets denoiser history.
+        if (std::abs(_smoothScale - _scale) > ScaleStep * 0.75f) {
+            _scale = std::clamp(std::round(_smoothScale / ScaleStep) * ScaleStep, MinScale, 1.0f);
+        }
+        glm::uvec2 size = glm::uvec2(glm::vec2(outputSize) * _scale) & ~(SizeAlignment - 1);
+        return glm::clamp(size, glm::uvec2(SizeAlignment), outputSize);
+    }
+    float GetScale() const { return _scale; }
+
+    void DrawSettings(glim::SettingStore& settings) {
+        settings.Checkbox("Dynamic Resolution", &Enabled);
+
+        if (Enabled) {
+            settings.Slider("Target Frame Time", &TargetFrameMs, 1, 4.0f, 100.0f, "%.1f ms");
+            settings.Slider("Min Render Scale", &MinScale, 1, 0.25f, 1.0f, "%.2f");
+            ImGui::Text("Render Scale: %.0f%%", _scale * 100.0f);
+        }
+    }
+
+private:
+    static constexpr float ScaleStep = 1.0f / 16;
+    static constexpr uint32_t SizeAlignment = 8;  // Multiple of the CPU renderer SIMD tile size
+
+    float _scale = 1.0f, _smoothScale = 1.0f;
+};
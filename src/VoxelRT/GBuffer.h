@@ -7,7 +7,7 @@
 struct GBuffer {
     enum class DebugChannel { None, Albedo, Irradiance, Normals, TraversalIters, Variance };
 
-    std::shared_ptr<ogl::Shader> ReprojShader, FilterShader, PresentShader;
+    std::shared_ptr<ogl::Shader> ReprojShader, FilterShader, UpscaleShader, PresentShader;
 
     std::unique_ptr<ogl::Texture2D> AlbedoTex, PrevAlbedoTex;
     std::unique_ptr<ogl::Texture2D> IrradianceTex, PrevIrradianceTex, TempIrradianceTex;
@@ -15,8 +15,13 @@ struct GBuffer {
     std::unique_ptr<ogl::Texture2D> MomentsTex, PrevMomentsTex;
     std::unique_ptr<ogl::Texture2D> HistoryLenTex;
 
-    glm::mat4 CurrentProj, HistoryProj;
+    // Output resolution radiance, only allocated when rendering below it
+    std::unique_ptr<ogl::Texture2D> UpscaledTex, PrevUpscaledTex;
+
+    glm::mat4 CurrentProj, HistoryProj;          // Includes upscaling jitter
+    glm::mat4 CurrentBaseProj, HistoryBaseProj;  // Without jitter
     glm::dvec3 CurrentPos, HistoryPos;
+    glm::vec2 Jitter = glm::vec2(0.0f);  // Offset of render samples from pixel centers, in render pixels
     uint32_t FrameNo = 0;
 
     DebugChannel DebugChannelView = DebugChannel::None;
@@ -25,10 +30,12 @@ struct GBuffer {
     GBuffer(ogl::ShaderLib& shlib) {
         ReprojShader = shlib.LoadComp("Denoise/Reproject");
         FilterShader = shlib.LoadComp("Denoise/Filter");
+        UpscaleShader = shlib.LoadComp("TemporalUpscale");
         PresentShader = shlib.LoadFrag("GBufferBlit");
     }
 
-    void SetCamera(glim::Camera& cam, glm::ivec2 viewSize, bool resetHistory) {
+    // `viewSize` is the render resolution, which is temporally upscaled to `outputSize` if smaller.
+    void SetCamera(glim::Camera& cam, glm::ivec2 viewSize, glm::ivec2 outputSize, bool resetHistory) {
         if (AlbedoTex == nullptr || AlbedoTex->Width != viewSize.x || AlbedoTex->Height != viewSize.y) {
             AlbedoTex = std::make_unique<ogl::Texture2D>(viewSize.x, viewSize.y, 1, GL_RGBA8);
             PrevAlbedoTex = std::make_unique<ogl::Texture2D>(viewSize.x, viewSize.y, 1, GL_RGBA8);
@@ -44,16 +51,41 @@ struct GBuffer {
             PrevMomentsTex = std::make_unique<ogl::Texture2D>(viewSize.x, viewSize.y, 1, GL_RG16F);
 
             HistoryLenTex = std::make_unique<ogl::Texture2D>(viewSize.x, viewSize.y, 1, GL_R8UI);
+
+            // Zero depth rejects all history samples in the reprojection pass
+            glClearTexImage(DepthTex->Handle, 0, GL_RED, GL_FLOAT, nullptr);
+            glClearTexImage(PrevDepthTex->Handle, 0, GL_RED, GL_FLOAT, nullptr);
+            glClearTexImage(HistoryLenTex->Handle, 0, GL_RED_INTEGER, GL_UNSIGNED_BYTE, nullptr);
+        }
+        bool upscaling = viewSize != outputSize;
+
+        if (!upscaling) {
+            UpscaledTex = nullptr;
+            PrevUpscaledTex = nullptr;
+        } else if (UpscaledTex == nullptr || UpscaledTex->Width != outputSize.x || UpscaledTex->Height != outputSize.y) {
+            UpscaledTex = std::make_unique<ogl::Texture2D>(outputSize.x, outputSize.y, 1, GL_RGBA16F);
+            PrevUpscaledTex = std::make_unique<ogl::Texture2D>(outputSize.x, outputSize.y, 1, GL_RGBA16F);
+            PrevUpscaledTex->SetWrapMode(GL_CLAMP_TO_EDGE);
+            UpscaledTex->SetWrapMode(GL_CLAMP_TO_EDGE);
+            _resetUpscaleHistory = true;
         }
         HistoryPos = CurrentPos;
         HistoryProj = CurrentProj;
+        HistoryBaseProj = CurrentBaseProj;
 
         CurrentPos = cam.ViewPosition;
-        CurrentProj = cam.GetProjMatrix() * cam.GetViewMatrix(false);
+        CurrentBaseProj = cam.GetProjMatrix() * cam.GetViewMatrix(false);
+
+        // Sub-pixel jitter lets the upscaler gather samples at different positions over frames.
+        // Sample at `pixelCenter + Jitter` means shifting the image by `-Jitter`.
+        Jitter = upscaling ? Halton23[FrameNo % 16] - 0.5f : glm::vec2(0.0f);
+        glm::vec2 jitterNDC = -2.0f * Jitter / glm::vec2(viewSize);
+        CurrentProj = glm::translate(glm::mat4(1.0f), glm::vec3(jitterNDC, 0.0f)) * CurrentBaseProj;
 
         std::swap(AlbedoTex, PrevAlbedoTex);
         std::swap(DepthTex, PrevDepthTex);
         std::swap(MomentsTex, PrevMomentsTex);
+        if (upscaling) std::swap(UpscaledTex, PrevUpscaledTex);
         FrameNo++;
 
         ReprojShader->SetUniform("u_ForceResetHistory", resetHistory);
@@ -120,8 +152,24 @@ struct GBuffer {
             }
         }
 
+        if (UpscaledTex != nullptr) {
+            glm::ivec2 outputSize = glm::ivec2(UpscaledTex->Width, UpscaledTex->Height);
+
+            SetUniforms(*UpscaleShader);
+            UpscaleShader->SetUniform("u_UpscaledTex", *UpscaledTex);
+            UpscaleShader->SetUniform("u_PrevUpscaledTex", *PrevUpscaledTex);
+            UpscaleShader->SetUniform("u_OutputInvProjMat", GetInverseProjScreenMat(CurrentBaseProj, outputSize));
+            UpscaleShader->SetUniform("u_HistoryOutputProjMat", HistoryBaseProj);
+            UpscaleShader->SetUniform("u_Jitter", Jitter);
+            UpscaleShader->SetUniform("u_ResetUpscaleHistory", _resetUpscaleHistory);
+            UpscaleShader->DispatchCompute((outputSize.x + 7) / 8, (outputSize.y + 7) / 8, 1);
+            _resetUpscaleHistory = false;
+        }
+
         // Blit to screen
         SetUniforms(*PresentShader);
+        PresentShader->SetUniform("u_UseUpscaledTex", UpscaledTex != nullptr);
+        PresentShader->SetUniform("u_UpscaledTex", UpscaledTex != nullptr ? *UpscaledTex : *AlbedoTex);  // don't leave a dangling binding
         PresentShader->DispatchFullscreen();
 
         if (NumDenoiserPasses == 0) {
@@ -145,4 +193,7 @@ struct GBuffer {
         { 0.56250, 0.03704 }, { 0.31250, 0.37037 }, { 0.81250, 0.70370 }, { 0.18750, 0.14815 },  //
         { 0.68750, 0.48148 }, { 0.43750, 0.81481 }, { 0.93750, 0.25926 }, { 0.03125, 0.59259 },
     };
+
+private:
+    bool _resetUpscaleHistory = true;
 };
\ No newline at end of file
@@ -33,6 +33,7 @@ struct GpuVoxelStorage {
     };
     struct UpdateRequest {
         uint32_t Count;
+        uint32_t NumCached;  // Number of leading entries whose occupancy masks are uploaded from the map cache
         glm::uvec3 BrickLocs[];
     };
     GpuMeta* MappedStorage; // Write only!
@@ -47,6 +48,7 @@ struct GpuVoxelStorage {
 
         uint32_t maxSlotId = SlotAllocator.Arena.NumAllocated;
         uint32_t dirtyBricksInBatch = 0;
+        uint32_t cachedBricksInBatch = 0;
 
         // Allocate slots for dirty bricks
         for (auto [sectorIdx, dirtyMask] : map.DirtyLocs) {
@@ -55,12 +57,14 @@ struct GpuVoxelStorage {
             if (sectorAlloc == nullptr) continue;
 
             uint64_t freeMask;
+            uint64_t cacheMask = 0;
 
             if (map.Sectors.contains(sectorIdx)) {
                 Sector& sector = map.Sectors[sectorIdx];
                 uint64_t allocMask = sector.GetAllocationMask();
                 dirtyMask &= allocMask;
                 freeMask = sectorAlloc->AllocMask & ~allocMask;
+                cacheMask = sector.OccupancyCacheMask;
             } else {
                 dirtyMask = 0;
                 freeMask = ~0ull;
@@ -73,6 +77,7 @@ struct GpuVoxelStorage {
                 dirtyMask |= SlotAllocator.Alloc(sectorAlloc, dirtyMask);
                 maxSlotId = std::max(maxSlotId, sectorAlloc->BaseSlot + (uint32_t)std::popcount(sectorAlloc->AllocMask));
                 dirtyBricksInBatch += (uint32_t)std::popcount(dirtyMask);
+                cachedBricksInBatch += (uint32_t)std::popcount(dirtyMask & cacheMask);
             }
             updateBatch.push_back({ sectorIdx, dirtyMask });
         }
@@ -109,7 +114,11 @@ struct GpuVoxelStorage {
         // Upload brick data
         auto updateBuffer = ogl::Buffer(dirtyBricksInBatch * sizeof(glm::uvec3) + sizeof(UpdateRequest), GL_MAP_WRITE_BIT);
         auto updateLocs = updateBuffer.Map<UpdateRequest>(GL_MAP_WRITE_BIT);
-        uint32_t updateLocIdx = 0;
+        uint32_t updateLocIdx = cachedBricksInBatch, cachedLocIdx = 0;
+
+        // Bricks with occupancy masks loaded from disk don't need to be re-built, they're just copied by the shader.
+        auto cachedBuffer = ogl::Buffer(std::max(cachedBricksInBatch, 1u) * sizeof(BrickOccupancy), GL_MAP_WRITE_BIT);
+        auto cachedMasks = cachedBuffer.Map<BrickOccupancy>(GL_MAP_WRITE_BIT);
 
         for (auto [sectorIdx, dirtyMask] : updateBatch) {
             glm::ivec3 sectorPos = WorldSectorIndexer::GetPos(sectorIdx);
@@ -117,17 +126,23 @@ struct GpuVoxelStorage {
 
             // Write bricks to GPU storage
             if (dirtyMask != 0) {
-                Sector& sector = map.Sectors[sectorIdx];
+                const Sector& sector = map.Sectors[sectorIdx];
 
                 for (uint32_t brickIdx : BitIter(dirtyMask)) {
                     uint32_t slotIdx = sectorAlloc->GetSlot(brickIdx) - 1;
                     assert(slotIdx < maxBricksInBuffer);
 
-                    Brick* brick = sector.GetBrick(brickIdx);
+                    const Brick* brick = sector.GetBrick(brickIdx);
                     MappedStorage->Bricks[slotIdx] = *brick;
 
                     glm::uvec3 brickPos = sectorPos * MaskIndexer::Size + MaskIndexer::GetPos(brickIdx);
-                    updateLocs->BrickLocs[updateLocIdx++] = brickPos;
+
+                    if (auto cached = sector.GetCachedOccupancy(brickIdx)) {
+                        cachedMasks.get()[cachedLocIdx] = *cached;
+                        updateLocs->BrickLocs[cachedLocIdx++] = brickPos;
+                    } else {
+                        updateLocs->BrickLocs[updateLocIdx++] = brickPos;
+                    }
                 }
             }
 
@@ -158,9 +173,13 @@ struct GpuVoxelStorage {
         // device_local memory that is also coherent (at least from the perspective of Vulkan).
         StorageBuffer->FlushMappedRange(0, StorageBuffer->Size);
 
+        assert(cachedLocIdx == cachedBricksInBatch);
         updateLocs->Count = updateLocIdx;
+        updateLocs->NumCached = cachedLocIdx;
         updateLocs.reset();
+        cachedMasks.reset();
         BuildOccupancyShader->SetUniform("ssbo_UpdateLocs", updateBuffer);
+        BuildOccupancyShader->SetUniform("ssbo_CachedOccupancy", cachedBuffer);
         BuildOccupancyShader->SetUniform("ssbo_VoxelData", *StorageBuffer);
         BuildOccupancyShader->SetUniform("ssbo_VoxelOccupancy", *OccupancyStorage);
         BuildOccupancyShader->DispatchCompute(1, 1, (updateLocIdx + 63) / 64);
@@ -189,26 +208,6 @@ struct GpuVoxelStorage {
     }
 };
 
-// Based on https://www.youtube.com/watch?v=P2bGF6GPmfc
-static void GenerateRayCellInteractionMaskLUT(uint64_t table[64 * 8]) {
-    for (uint64_t dirOct = 0; dirOct < 8; dirOct++) {
-        glm::ivec3 dir = (glm::ivec3(dirOct) >> glm::ivec3(0, 1, 2) & 1) * 2 - 1;
-
-        for (uint64_t originIdx = 0; originIdx < 64; originIdx++) {
-            uint64_t mask = 0;
-
-            for (uint64_t j = 0; j < 64; j++) {
-                glm::ivec3 pos = MaskIndexer::GetPos(originIdx) + MaskIndexer::GetPos(j) * dir;
-
-                if (MaskIndexer::CheckInBounds(pos)) {
-                    mask |= 1ull << MaskIndexer::GetIndex(pos);
-                }
-            }
-            table[originIdx + dirOct * 64] = mask;
-        }
-    }
-}
-
 GpuRenderer::GpuRenderer(ogl::ShaderLib& shlib, std::shared_ptr<VoxelMap> map) {
     _map = std::move(map);
     _storage = std::make_unique<GpuVoxelStorage>(shlib);
@@ -246,11 +245,14 @@ void GpuRenderer::RenderFrame(glim::Camera& cam, glm::uvec2 viewSize) {
     }
     _storage->SyncBuffers(*_map);
 
-    _gbuffer->SetCamera(cam, viewSize, worldChanged);
-
     GLint64 frameElapsedNs;
     glGetQueryObjecti64v(_frameQueryObj, GL_QUERY_RESULT, &frameElapsedNs);
     _frameTime.AddSample(frameElapsedNs / 1000000.0);
+
+    glm::uvec2 outputSize = viewSize;
+    viewSize = _dynamicRes.Update(_frameTime.GetLastMs(), outputSize);
+    _gbuffer->SetCamera(cam, viewSize, outputSize, worldChanged);
+
     glBeginQuery(GL_TIME_ELAPSED, _frameQueryObj);
 
     // Trace
@@ -279,6 +281,7 @@ void GpuRenderer::DrawSettings(glim::SettingStore& settings) {
     settings.Slider("Light Bounces", &_numLightBounces, 1, 0u, 5u);
     settings.Slider("Denoiser Passes", &_gbuffer->NumDenoiserPasses, 1, 0u, 5u);
     settings.Checkbox("Anisotropic LODs", &_useAnisotropicLods);
+    _dynamicRes.DrawSettings(settings);
     ImGui::PopItemWidth();
     
     ImGui::Separator();
@@ -13,6 +13,9 @@
 #include "Renderer.h"
 #include "TerrainGenerator.h"
 #include "Brush.h"
+#include "WorldAutosave.h"
+#include "WorldHashTree.h"
+#include "CameraPath.h"
 
 class Application {
     glim::Camera _cam = {};
@@ -23,6 +26,11 @@ class Application {
     std::unique_ptr<ogl::ShaderLib> _shaderLib;
     std::unique_ptr<Renderer> _renderer;
     std::unique_ptr<TerrainGenerator> _terrainGen;
+    std::unique_ptr<WorldAutosave> _autosave;
+    WorldHashTree _hashTree;
+
+    CameraPath _recordedPath;
+    bool _isRecordingPath = false;
 
     BrushSession _brush;
 
@@ -35,18 +43,16 @@ public:
         _map = std::make_shared<VoxelMap>();
 
         try {
-            _map->Deserialize("logs/voxels_2k_sponza.dat");
-        } catch (std::exception& ex) {
-            std::cout << "Failed to load voxel map cache: " << ex.what() << std::endl;
-
-            auto model = glim::Model("assets/models/Sponza/Sponza.gltf");
-            // auto model = glim::Model("../SwRastCPP/logs/assets/models/Bistro_GLTF/BistroExterior.gltf");
-            // auto model = glim::Model("logs/assets/models/ship_pinnace_4k/ship_pinnace_4k.gltf");
-            // auto model = glim::Model("logs/assets/models/DamagedHelmet/DamagedHelmet.gltf");
+            const char* modelPath = "assets/models/Sponza/Sponza.gltf";
+            // const char* modelPath = "../SwRastCPP/logs/assets/models/Bistro_GLTF/BistroExterior.gltf";
+            // const char* modelPath = "logs/assets/models/ship_pinnace_4k/ship_pinnace_4k.gltf";
+            // const char* modelPath = "logs/assets/models/DamagedHelmet/DamagedHelmet.gltf";
 
-            _map->VoxelizeModel(model, glm::uvec3(0), glm::uvec3(2048));
-
-            _map->Serialize("logs/voxels_2k_sponza.dat");
+            if (!_map->LoadOrVoxelizeModel(modelPath, glm::uvec3(0), glm::uvec3(2048), "logs/voxel_cache/")) {
+                std::cout << "Voxelized model (no cache entry found): " << modelPath << std::endl;
+            }
+        } catch (std::exception& ex) {
+            std::cout << "Failed to load model: " << ex.what() << std::endl;
         }
 
         _map->Palette[245] = { .Color = { 70, 150, 64 } };
@@ -72,6 +78,8 @@ public:
         _map->Set(glm::ivec3(3, 5, 3), Voxel::Create(255));
         _map->Set(glm::ivec3(4, 6, 3), Voxel::Create(254));
         _map->Set(glm::ivec3(10, 6, 3), Voxel::Create(254));
+        _autosave = std::make_unique<WorldAutosave>(_map, "logs/voxels_autosave.dat");
+        _hashTree.Build(*_map);
 
         _cam.Position = glm::vec3(512, 128, 512);
         _cam.MoveSpeed = 180;
@@ -91,9 +99,11 @@ public:
             if (sector == nullptr) break;
 
             uint32_t sectorIdx = WorldSectorIndexer::GetIndex(sectorPos);
-            _map->DirtyLocs[sectorIdx] = sector->GetAllocationMask();
+            _map->MarkDirty(sectorIdx, sector->GetAllocationMask());
             _map->Sectors[sectorIdx] = std::move(*sector);
         }
+        _autosave->Update();
+        _hashTree.Update(*_map);
 
         ImGui::Begin("Settings");
 
@@ -116,12 +126,30 @@ public:
         _renderer->DrawSettings(_settings);
 
         ImGui::Text("Total Sectors: %zu (%d pending gen)", _map->Sectors.size(), _terrainGen->GetNumPendingRequests());
+        ImGui::Text("World Hash: %016llx", (unsigned long long)_hashTree.GetRootHash());
+
+        _autosave->DrawSettings(_settings);
 
         ImGui::SeparatorText("Camera");
         _settings.Input("Pos", &_cam.Position.x, 3, "%.1f");
         _settings.Drag("Rot", &_cam.Euler.x, 2, -3.141f, +3.141f, 0.1f, "%.1f");
         _settings.Drag("Speed", &_cam.MoveSpeed, 1, 0.5f, 1000.0f, 1.0f, "%.1f");
         _settings.Drag("FOV", &_cam.FieldOfView, 1, 10.0f, 120.0f, 0.5f, "%.1f deg");
+
+        // Recorded paths can be replayed by the benchmark tool
+        if (ImGui::Button(_isRecordingPath ? "Stop Recording" : "Record Path")) {
+            if (_isRecordingPath) {
+                _recordedPath.Save("logs/camera_path.txt");
+            }
+            _recordedPath.Frames.clear();
+            _isRecordingPath = !_isRecordingPath;
+        }
+        if (_isRecordingPath) {
+            _recordedPath.Frames.push_back({ .Position = _cam.Position, .Euler = _cam.Euler, .FieldOfView = _cam.FieldOfView });
+
+            ImGui::SameLine();
+            ImGui::Text("%zu frames", _recordedPath.Frames.size());
+        }
         ImGui::End();
 
         _renderer->RenderFrame(_cam, glm::uvec2(vpWidth, vpHeight));
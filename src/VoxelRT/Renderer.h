@@ -6,10 +6,12 @@
 #include <imgui.h>
 #include <Common/Camera.h>
 #include <Common/SettingStore.h>
+#include <Common/ThreadPool.h>
 
 #include <OGL/QuickGL.h>
 #include <OGL/ShaderLib.h>
 
+#include "DynamicResolution.h"
 #include "VoxelMap.h"
 
 struct Renderer {
@@ -21,6 +23,10 @@ struct Renderer {
 
 struct GpuVoxelStorage;
 struct FlatVoxelStorage;
+struct Framebuffer;
+struct WavefrontScratch;
+struct IrradianceCache;
+struct CpuDenoiser;
 
 struct GBuffer;
 
@@ -45,23 +51,118 @@ private:
     bool _useAnisotropicLods;
 
     glim::TimeStat _frameTime;
+    DynamicResolution _dynamicRes;
     GLuint _frameQueryObj = 0;
     std::unique_ptr<ogl::Buffer> _metricsBuffer;
 };
 struct CpuRenderer : public Renderer {
+    // Fraction of pixels that trace bounce rays each frame, the rest are interpolated from neighbors.
+    enum class LightingRate { Full, Checkerboard, Quarter };
+
+    struct FrameStats {
+        double SyncMs = 0, TraceMs = 0;
+        uint32_t NumSyncedBricks = 0;
+        uint64_t NumRays = 0;            // Number of rays cast, including bounces
+        uint64_t NumTraversalIters = 0;  // Total number of traversal steps over all rays
+        uint64_t NumTraversalSteps = 0;  // Total number of packet traversal steps, including inactive lanes
+        uint64_t NumPrimaryRays = 0;
+        uint64_t NumPrimaryIters = 0;    // Traversal steps over primary rays only
+        uint64_t NumPrimarySteps = 0;    // Packet traversal steps over primary rays only, including inactive lanes
+        uint64_t NumBeamIters = 0;       // Cone steps taken by the beam prepass, not included in NumTraversalIters
+        double DepthReuseRate = 0;       // Fraction of beam cells whose primary rays started from reprojected depth
+        double IrradianceCacheHitRate = 0;  // Fraction of first bounce hits that used cached irradiance
+        double DenoiseMs = 0;
+    };
+    struct AccumulationParams {
+        uint32_t SamplesPerPass = 4;  // Samples per pixel traced for each unconverged tile in every pass
+        uint32_t MinSamples = 16;     // Samples per pixel before a tile can be considered converged
+        uint32_t MaxSamples = 1024;
+        float TargetNoise = 0.01f;    // Standard error of the mean irradiance luminance relative to the tile's mean
+    };
+    struct AccumulationStats {
+        uint64_t NumSamples = 0;  // Total pixel samples over all tiles
+        uint64_t NumRays = 0;
+        double ElapsedMs = 0;
+        double SamplesPerSec = 0;
+        double TimeToTargetMs = -1;  // Time until all tiles reached TargetNoise, or -1 if some stopped at MaxSamples
+        uint32_t NumTiles = 0, NumConvergedTiles = 0;
+        uint32_t MaxSamplesPerPixel = 0;
+        double MaxNoise = 0;
+    };
+    uint32_t NumLightBounces = 1;
+    bool UseWavefront = false;  // Trace bounces in compacted ray queues rather than per packet
+    bool SortBounceRays = true; // Reorder wavefront queues by direction and origin before each bounce
+    bool UsePersistentLanes = false;  // Refill terminated lanes with queued rays while tracing in wavefront mode, primary rays included
+    bool UseAnisotropicLods = false;  // Filter occupancy masks by ray octant to take larger steps
+    bool CacheStepMasks = false;      // Reuse masks gathered on previous traversal steps, and prefetch the next brick
+    bool CoarseBounceRays = false;    // Let bounce rays stop at any voxel in occupied 4x4x4 cells after some distance
+    uint32_t CoarseBounceThreshold = 30;  // Iterations or voxels of distance before bounce rays go coarse. Lower is faster
+    bool UseBeamPrepass = false;      // March a cone per 8x8 pixel beam first, so that primary rays can start closer to surfaces
+    bool UseDepthReuse = false;       // Start primary rays near the reprojected hits of the previous frame
+    LightingRate BounceRayRate = LightingRate::Full;  // Reduced rates are much faster, but blurrier without denoising
+    bool UseIrradianceCache = false;  // Reuse irradiance at first bounce hits from a world space cache, instead of tracing further. Needs NumLightBounces >= 2
+    uint32_t NumDenoiserPasses = 0;   // A-trous passes of the headless CPU denoiser, 0 disables it
+
     CpuRenderer(ogl::ShaderLib& shlib, std::shared_ptr<VoxelMap> map);
+    // Creates a headless renderer, which doesn't need an OpenGL context.
+    // Frames are kept in host memory and can be retrieved with GetColorImage() or GetRadianceImage().
+    CpuRenderer(std::shared_ptr<VoxelMap> map);
     ~CpuRenderer();
 
     virtual void RenderFrame(glim::Camera& cam, glm::uvec2 viewSize);
     virtual void DrawSettings(glim::SettingStore& settings);
 
+    bool IsHeadless() const { return _gbuffer == nullptr; }
+    const FrameStats& GetLastFrameStats() const { return _lastStats; }
+
+    // Progressively renders a still with a fixed camera in headless mode, averaging many frames until each tile
+    // converges to the target noise or reaches the max number of samples. Tiles are BlockSize pixels wide.
+    // The result replaces the last headless frame, and is never denoised.
+    AccumulationStats Accumulate(glim::Camera& cam, glm::uvec2 viewSize, const AccumulationParams& params);
+
+    // Detiles and tonemaps the last headless frame into RGBA8. Irradiance is only denoised if NumDenoiserPasses > 0.
+    swr::StbImage GetColorImage() const;
+    // Detiles the last headless frame into linear RGB32F radiance (albedo * irradiance).
+    swr::StbImage GetRadianceImage() const;
+
 private:
     std::shared_ptr<VoxelMap> _map;
     std::unique_ptr<FlatVoxelStorage> _storage;
 
     std::unique_ptr<GBuffer> _gbuffer;
     std::shared_ptr<ogl::Shader> _blitShader;
+    std::unique_ptr<CpuDenoiser> _denoiser;  // headless only, GL mode uses the GBuffer denoiser
+
+    simd::AlignedBuffer<uint8_t> _hostFramebuffer;
+    size_t _hostFramebufferSize = 0;
+
+    glm::mat4 _currentProj;
+    glm::dvec3 _currentPos;
+    uint32_t _frameNo = 0;
+
+    // Screen is split into square blocks of pixels, which are scheduled over the thread pool in Morton order.
+    static const uint32_t BlockSize = 32;
+    std::unique_ptr<glim::ThreadPool> _threadPool;
+    std::vector<glim::ThreadPool::WorkerStats> _blockWorkerStats;  // Copied after block rendering, before later passes overwrite them
+    std::vector<std::unique_ptr<WavefrontScratch>> _wavefrontScratch;  // per worker
+    std::unique_ptr<IrradianceCache> _irradianceCache;  // Null if disabled, dropped when turned off
+    std::vector<uint32_t> _blockOrder;
+    glm::uvec2 _blockOrderSize = glm::uvec2(0);
+    std::vector<float> _beamDists;
+
+    // Depth reuse state. Primary hit distances are in framebuffer tile order.
+    std::vector<float> _primaryDists;
+    std::vector<float> _primaryEmission;  // for reduced rate lighting, same order as _primaryDists
+    std::vector<uint32_t> _reprojectedDists;
+    std::vector<float> _reuseDists;
+    glm::mat4 _prevInvProj;
+    glm::dvec3 _prevPos;
+    glm::uvec2 _prevViewSize = glm::uvec2(0);
 
-    uint32_t _numLightBounces = 1;
     glim::TimeStat _frameTime;
+    DynamicResolution _dynamicRes;  // not used in headless mode, frames are always rendered at the requested size
+    FrameStats _lastStats;
+
+    void RenderTiles(Framebuffer* fb, glm::uvec2 viewSize);
+    Framebuffer* GetHostFramebuffer(glm::uvec2 viewSize);
 };
\ No newline at end of file
@@ -2,6 +2,8 @@ in vec2 v_FragCoord;
 out vec4 o_FragColor;
 
 uniform int u_DebugChannel;
+uniform bool u_UseUpscaledTex;
+uniform sampler2D u_UpscaledTex; // output resolution radiance, when rendering below it
 
 #include "GBuffer.glsl"
 
@@ -23,6 +25,10 @@ void main() {
 
     vec3 color = albedo * irradiance;
 
+    if (u_UseUpscaledTex) {
+        color = texelFetch(u_UpscaledTex, ivec2(v_FragCoord * textureSize(u_UpscaledTex, 0)), 0).rgb;
+    }
+
     color *= 0.48;
     color = aces_approx(color);
     color = pow(color, vec3(0.45));
@@ -1,5 +1,7 @@
 #include "TerrainGenerator.h"
 
+#include <utility>
+
 #include <FastNoise/FastNoise.h>
 
 uint64_t TerrainGenerator::GenerateSector(Sector& sector, glm::ivec3 sectorPos) {
@@ -136,10 +138,10 @@ void TerrainGenerator::WorkerFn() {
 
         // Copy non-empty bricks to new sector
         auto sector = std::make_unique<Sector>();
-        sector->Storage.reserve((uint32_t)std::popcount(mask));
+        sector->Reserve((uint32_t)std::popcount(mask));
 
         for (uint32_t i : BitIter(mask)) {
-            *sector->GetBrick(i, true) = *workSector.GetBrick(i);
+            *sector->GetBrick(i, true) = *std::as_const(workSector).GetBrick(i);
         }
         _queue->PushResult(pos, std::move(sector));
     }
@@ -2,17 +2,23 @@
 
 #include <Common/BinaryIO.h>
 #include <sstream>
+#include <utility>
 
 Brick* Sector::GetBrick(uint32_t index, bool create) {
     uint8_t& slot = BrickSlots[index];
-    if (slot != 0) {
-        return &Storage[slot - 1];
+    if (slot == 0 && !create) return nullptr;
+
+    // Copy on write. A stale count from another thread dropping its reference only causes an extra copy.
+    if (Storage == nullptr) {
+        Storage = std::make_shared<std::vector<Brick>>();
+    } else if (Storage.use_count() > 1) {
+        Storage = std::make_shared<std::vector<Brick>>(*Storage);
     }
-    if (create) {
-        slot = (uint8_t)Storage.size() + 1;
-        return &Storage.emplace_back();
+    if (slot != 0) {
+        return &(*Storage)[slot - 1];
     }
-    return nullptr;
+    slot = (uint8_t)Storage->size() + 1;
+    return &Storage->emplace_back();
 }
 
 void Sector::DeleteBricks(uint64_t mask) {
@@ -20,14 +26,26 @@ void Sector::DeleteBricks(uint64_t mask) {
 
     uint64_t allocMask = GetAllocationMask() & ~mask;
     Sector newSect;
-    newSect.Storage.reserve((uint32_t)std::popcount(allocMask));
+    newSect.Reserve((uint32_t)std::popcount(allocMask));
+
+    uint64_t cacheMask = OccupancyCacheMask & allocMask;
+    std::shared_ptr<std::vector<BrickOccupancy>> newOccupancy;
+    if (cacheMask != 0) {
+        newOccupancy = std::make_shared<std::vector<BrickOccupancy>>((uint32_t)std::popcount(allocMask));
+        newSect.OccupancyCacheMask = cacheMask;
+    }
 
     for (; allocMask != 0; allocMask &= allocMask - 1) {
         uint32_t i = (uint32_t)std::countr_zero(allocMask);
-        Brick* brick = GetBrick(i);
+        const Brick* brick = std::as_const(*this).GetBrick(i);
 
         *newSect.GetBrick(i, true) = *brick;
+
+        if (cacheMask >> i & 1) {
+            (*newOccupancy)[newSect.BrickSlots[i] - 1] = *GetCachedOccupancy(i);
+        }
     }
+    newSect.OccupancyCache = std::move(newOccupancy);
     *this = std::move(newSect);
 
     /*
@@ -50,7 +68,7 @@ void Sector::DeleteBricks(uint64_t mask) {
     Storage.shrink_to_fit();*/
 }
 
-uint64_t Sector::GetAllocationMask() {
+uint64_t Sector::GetAllocationMask() const {
     static_assert(sizeof(BrickSlots) == 64);
 
 #ifdef __AVX512F__
@@ -68,7 +86,7 @@ uint64_t Sector::DeleteEmptyBricks(uint64_t mask) {
     uint64_t emptyMask = 0;
 
     for (uint32_t i : BitIter(mask)) {
-        Brick* brick = GetBrick(i);
+        const Brick* brick = std::as_const(*this).GetBrick(i);
 
         if (brick != nullptr && brick->IsEmpty()) {
             emptyMask |= (1ull << i);
@@ -117,7 +135,7 @@ Brick* VoxelMap::GetBrick(glm::ivec3 pos, bool create, bool markAsDirty) {
     }
 
     if (markAsDirty) {
-        DirtyLocs[sectorIdx] |= 1ull << brickIdx;
+        MarkDirty(sectorIdx, 1ull << brickIdx, sector);
     }
     return sector->GetBrick(brickIdx, true);
 }
@@ -130,7 +148,7 @@ static int32_t GetStepLevel(VoxelMap* map, glm::ivec3 pos) {
         return k;
     }
     k = BrickIndexer::ShiftXZ;
-    Brick* brick = sectorIter->second.GetBrick(MaskIndexer::GetIndex(pos >> k));
+    const Brick* brick = std::as_const(sectorIter->second).GetBrick(MaskIndexer::GetIndex(pos >> k));
 
     if (brick == nullptr) {
         return k;
@@ -202,10 +220,54 @@ bool Brick::IsEmpty() const {
     return true;
 }
 
+// Returns mask of non-empty voxels in a 8x8 XZ slice, bit index is `x + z * 8`.
+static uint64_t GetSliceOccupancy(const uint8_t* ptr) {
+#ifdef __AVX512F__
+    auto a = _mm512_loadu_epi8(ptr);
+    return _mm512_test_epi8_mask(a, a);
+#elif __AVX2__
+    auto a = _mm256_loadu_si256((__m256i*)&ptr[0]);
+    auto b = _mm256_loadu_si256((__m256i*)&ptr[32]);
+    uint32_t emptyA = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, _mm256_set1_epi8(0)));
+    uint32_t emptyB = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(b, _mm256_set1_epi8(0)));
+    return ~((uint64_t)emptyB << 32 | emptyA);
+#else
+    uint64_t mask = 0;
+    for (uint32_t i = 0; i < 64; i++) {
+        mask |= uint64_t(ptr[i] != 0) << i;
+    }
+    return mask;
+#endif
+}
+
+void Brick::ComputeOccupancy(BrickOccupancy& dest) const {
+    static_assert(BrickIndexer::SizeXZ == 8 && BrickIndexer::SizeY == 8);
+    static_assert(BrickMaskIndexer::ShiftXZ == 1 && BrickMaskIndexer::ShiftY == 1);
+
+    dest = {};
+
+    for (uint32_t y = 0; y < 8; y++) {
+        uint64_t slice = GetSliceOccupancy((uint8_t*)&Data[y * 64]);
+
+        for (uint32_t cx = 0; cx < 2; cx++) {
+            // Pack the 4 X bits of each Z row together, giving 16-bit `vx + vz * 4` masks for both cells along Z.
+            uint64_t rows = (slice >> (cx * 4)) & 0x0F0F'0F0F'0F0F'0F0Full;
+            rows = (rows | rows >> 4) & 0x00FF'00FF'00FF'00FFull;
+            rows = (rows | rows >> 8) & 0x0000'FFFF'0000'FFFFull;
+            rows = (rows | rows >> 16) & 0x0000'0000'FFFF'FFFFull;
+
+            uint32_t cellIdx = BrickMaskIndexer::GetIndex(cx, y / 4, 0u);
+            dest.Cells[cellIdx + 0] |= (rows & 0xFFFF) << (y % 4 * 16);
+            dest.Cells[cellIdx + 2] |= (rows >> 16) << (y % 4 * 16);
+        }
+    }
+}
+
 namespace gio = glim::io;
 
 // TODO: This serialization format is as horrible as iostreams. switch to/design something better
-static const uint64_t SerMagic = 0x00'00'00'04'78'6f'76'63ul;  // "cvox 0004"
+static const uint64_t SerMagic = 0x00'00'00'05'78'6f'76'63ul;  // "cvox 0005"
+static const uint64_t SerMagicV4 = 0x00'00'00'04'78'6f'76'63ul;  // "cvox 0004", same as v5 but without occupancy masks
 static const uint32_t MaxPackSize = 1024 * 1024 * 16;
 
 void VoxelMap::Deserialize(std::string_view filename) {
@@ -214,10 +276,14 @@ void VoxelMap::Deserialize(std::string_view filename) {
     if (!is.is_open()) {
         throw std::runtime_error("File not found");
     }
-
-    if (gio::Read<uint64_t>(is) != SerMagic) {
+    Deserialize(is);
+}
+void VoxelMap::Deserialize(std::istream& is) {
+    uint64_t magic = gio::Read<uint64_t>(is);
+    if (magic != SerMagic && magic != SerMagicV4) {
         throw std::runtime_error("Incompatible file");
     }
+    bool hasOccupancy = magic == SerMagic;
     uint32_t numSectors = gio::Read<uint32_t>(is);
     Sectors.reserve(numSectors);
 
@@ -235,40 +301,94 @@ void VoxelMap::Deserialize(std::string_view filename) {
         uint64_t mask = gio::Read<uint64_t>(cst);
         Sector& sector = Sectors[idx];
 
-        sector.Storage.reserve((size_t)std::popcount(mask));
+        sector.Reserve((uint32_t)std::popcount(mask));
 
         for (uint32_t j : BitIter(mask)) {
             *sector.GetBrick(j, true) = gio::Read<Brick>(cst);
         }
+
+        if (hasOccupancy) {
+            auto occupancy = std::make_shared<std::vector<BrickOccupancy>>(sector.Storage->size());
+            sector.OccupancyCacheMask = mask;
+
+            for (uint32_t j : BitIter(mask)) {
+                (*occupancy)[sector.BrickSlots[j] - 1] = gio::Read<BrickOccupancy>(cst);
+            }
+            sector.OccupancyCache = std::move(occupancy);
+        }
     }
 }
+// Writes sector data in packs of at most `MaxPackSize` uncompressed bytes.
+// Each sector is stored as: u32 index, u64 allocation mask, Brick[popcnt(mask)], BrickOccupancy[popcnt(mask)]
+struct SectorPackWriter {
+    std::ostream& Output;
+    std::ostringstream PackStream;
+
+    SectorPackWriter(std::ostream& os, const Material palette[256], uint32_t numSectors) : Output(os) {
+        gio::Write<uint64_t>(os, SerMagic);
+        gio::Write<uint32_t>(os, numSectors);
+        gio::WriteCompressed(os, palette, sizeof(Material) * 256);
+    }
+
+    void Write(uint32_t idx, const Sector& sector) {
+        uint64_t mask = sector.GetAllocationMask();
+        gio::Write<uint32_t>(PackStream, idx);
+        gio::Write<uint64_t>(PackStream, mask);
+
+        for (uint32_t j : BitIter(mask)) {
+            gio::Write(PackStream, *sector.GetBrick(j));
+        }
+        // Storing occupancy masks allows renderers to skip re-building them after loading.
+        for (uint32_t j : BitIter(mask)) {
+            if (auto cached = sector.GetCachedOccupancy(j)) {
+                gio::Write(PackStream, *cached);
+            } else {
+                BrickOccupancy occupancy;
+                sector.GetBrick(j)->ComputeOccupancy(occupancy);
+                gio::Write(PackStream, occupancy);
+            }
+        }
+        Flush();
+    }
+    void Flush(bool final = false) {
+        if (PackStream.tellp() >= MaxPackSize || final) {
+            auto buf = PackStream.view();
+            gio::Write<uint32_t>(Output, buf.size());
+            gio::WriteCompressed(Output, buf.data(), buf.size());
+            PackStream.str("");
+        }
+    }
+};
+
 void VoxelMap::Serialize(std::string_view filename) {
     std::ofstream os(filename.data(), std::ios::binary | std::ios::trunc);
+    Serialize(os);
+}
+void VoxelMap::Serialize(std::ostream& os, bool mortonOrder) {
+    SectorPackWriter writer(os, Palette, Sectors.size());
 
-    gio::Write<uint64_t>(os, SerMagic);
-    gio::Write<uint32_t>(os, Sectors.size());
-    gio::WriteCompressed(os, Palette, sizeof(Palette));
-
-    std::ostringstream cst;
-    const auto FlushPack = [&](bool final = false) {
-        if (cst.tellp() >= MaxPackSize || final) {
-            auto buf = cst.view();
-            gio::Write<uint32_t>(os, buf.size());
-            gio::WriteCompressed(os, buf.data(), buf.size());
-            cst.str("");
+    // Z-order keeps nearby sectors in the same packs, which compresses better and improves load locality.
+    if (mortonOrder) {
+        for (uint32_t idx : GetMortonOrderedKeys(Sectors)) {
+            writer.Write(idx, Sectors[idx]);
+        }
+    } else {
+        for (auto& [idx, sector] : Sectors) {
+            writer.Write(idx, sector);
         }
-    };
+    }
+    writer.Flush(true);
+}
 
-    for (auto& [idx, sector] : Sectors) {
-        uint64_t mask = sector.GetAllocationMask();
-        gio::Write<uint32_t>(cst, idx);
-        gio::Write<uint64_t>(cst, mask);
+void VoxelMapSnapshot::Serialize(std::ostream& os, std::atomic_uint32_t* numWrittenSectors) const {
+    SectorPackWriter writer(os, Palette, Sectors.size());
 
-        for (uint32_t j : BitIter(mask)) {
-            Brick* brick = sector.GetBrick(j);
-            gio::Write(cst, *brick);
+    for (uint32_t idx : GetMortonOrderedKeys(Sectors)) {
+        writer.Write(idx, *Sectors.at(idx));
+
+        if (numWrittenSectors != nullptr) {
+            numWrittenSectors->fetch_add(1, std::memory_order_relaxed);
         }
-        FlushPack();
     }
-    FlushPack(true);
-}
\ No newline at end of file
+    writer.Flush(true);
+}
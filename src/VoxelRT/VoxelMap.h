@@ -1,7 +1,12 @@
 #pragma once
 
+#include <algorithm>
 #include <cstdint>
 #include <map>
+#include <vector>
+#include <memory>
+#include <iosfwd>
+#include <atomic>
 #include <glm/glm.hpp>
 
 #include <Common/Scene.h>
@@ -100,6 +105,73 @@ struct LinearIndexer3D {
 using WorldSectorIndexer = LinearIndexer3D<12, 8, true>;
 using MaskIndexer = LinearIndexer3D<2, 2, false>;      // 4x4x4 64-bit masks
 using BrickIndexer = LinearIndexer3D<3, 3, false>;
+using BrickMaskIndexer = LinearIndexer3D<BrickIndexer::ShiftXZ - 2, BrickIndexer::ShiftY - 2, false>;  // 4x4x4 cells within a brick
+
+// Generates masks of the cells that a ray starting at each 4x4x4 cell can interact with, for each direction octant.
+// Octant bits are set for positive directions (X=1, Y=2, Z=4).
+// Based on https://www.youtube.com/watch?v=P2bGF6GPmfc
+static void GenerateRayCellInteractionMaskLUT(uint64_t table[64 * 8]) {
+    for (uint64_t dirOct = 0; dirOct < 8; dirOct++) {
+        glm::ivec3 dir = (glm::ivec3(dirOct) >> glm::ivec3(0, 1, 2) & 1) * 2 - 1;
+
+        for (uint64_t originIdx = 0; originIdx < 64; originIdx++) {
+            uint64_t mask = 0;
+
+            for (uint64_t j = 0; j < 64; j++) {
+                glm::ivec3 pos = MaskIndexer::GetPos(originIdx) + MaskIndexer::GetPos(j) * dir;
+
+                if (MaskIndexer::CheckInBounds(pos)) {
+                    mask |= 1ull << MaskIndexer::GetIndex(pos);
+                }
+            }
+            table[originIdx + dirOct * 64] = mask;
+        }
+    }
+}
+
+// Returns the position of a world sector index along a Z-order (Morton) curve.
+// The low 8 bits of each axis are interleaved as YZX, and the remaining XZ bits as ZX.
+static uint32_t GetSectorMortonKey(uint32_t sectorIdx) {
+    static_assert(WorldSectorIndexer::ShiftXZ == 12 && WorldSectorIndexer::ShiftY == 8);
+
+    const auto spread3 = [](uint32_t v) {
+        v = (v | v << 8) & 0x0000F00F;
+        v = (v | v << 4) & 0x000C30C3;
+        v = (v | v << 2) & 0x00249249;
+        return v;
+    };
+    const auto spread2 = [](uint32_t v) {
+        v = (v | v << 2) & 0x33;
+        v = (v | v << 1) & 0x55;
+        return v;
+    };
+    glm::uvec3 pos = WorldSectorIndexer::GetPos(sectorIdx) - WorldSectorIndexer::MinPos;
+
+    uint32_t key = spread3(pos.x & 255) | spread3(pos.z & 255) << 1 | spread3(pos.y) << 2;
+    key |= (spread2(pos.x >> 8) | spread2(pos.z >> 8) << 1) << 24;
+    return key;
+}
+struct SectorMortonLess {
+    bool operator()(uint32_t a, uint32_t b) const { return GetSectorMortonKey(a) < GetSectorMortonKey(b); }
+};
+
+// Returns the indices of the given sector map, sorted in Z-order.
+template<typename TMap>
+static std::vector<uint32_t> GetMortonOrderedKeys(const TMap& sectors) {
+    std::vector<std::pair<uint32_t, uint32_t>> keys;
+    keys.reserve(sectors.size());
+
+    for (auto& [idx, sector] : sectors) {
+        keys.push_back({ GetSectorMortonKey(idx), idx });
+    }
+    std::sort(keys.begin(), keys.end());
+
+    std::vector<uint32_t> indices(keys.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+        indices[i] = keys[i].second;
+    }
+    return indices;
+}
 
 struct VoxelDispatchInvocationPars {
     VInt X, Y, Z;
@@ -107,12 +179,18 @@ struct VoxelDispatchInvocationPars {
     uint32_t GroupBaseIdx;
 };
 
+// 64-bit occupancy masks for each 4x4x4 cell within a brick.
+struct BrickOccupancy {
+    uint64_t Cells[BrickMaskIndexer::MaxArea];
+};
+
 struct Brick {
     static constexpr glm::ivec3 Size = BrickIndexer::Size;
 
     Voxel Data[BrickIndexer::MaxArea] = {};
 
     bool IsEmpty() const;
+    void ComputeOccupancy(BrickOccupancy& dest) const;
 
     // Iterates over voxels within this brick.
     template<typename F>
@@ -152,17 +230,38 @@ struct Brick {
 // TODO: consider implementing bit-packing: 1/2/4/8 bits per voxel
 //      - makes accesses difficult, need Get/Set, Gather/Scatter APIs
 //      - makes palette sharing difficult, but sector is 32³ so global sharing might still be reasonable
+//
+// Brick storage is shared between copies of a sector (e.g. in map snapshots), and copied by the first
+// non-const GetBrick() call on a shared sector. Read-only accesses should go through the const overload.
 struct Sector {
     static_assert(MaskIndexer::MaxArea == 64);
 
-    std::vector<Brick> Storage;
+    std::shared_ptr<std::vector<Brick>> Storage;  // Null if no bricks were ever allocated
     uint8_t BrickSlots[64]{};
 
+    // Occupancy masks loaded along with the map, indexed by brick slot. Never modified after loading.
+    // Entries are only valid for bricks in `OccupancyCacheMask`, which is cleared as bricks are modified.
+    std::shared_ptr<const std::vector<BrickOccupancy>> OccupancyCache;
+    uint64_t OccupancyCacheMask = 0;
+
+    // Returns a writable brick, copying storage first if it is shared with other sectors.
     Brick* GetBrick(uint32_t index, bool create = false);
+    const Brick* GetBrick(uint32_t index) const {
+        uint8_t slot = BrickSlots[index];
+        return slot != 0 ? &(*Storage)[slot - 1] : nullptr;
+    }
+    const BrickOccupancy* GetCachedOccupancy(uint32_t index) const {
+        return (OccupancyCacheMask >> index & 1) ? &(*OccupancyCache)[BrickSlots[index] - 1] : nullptr;
+    }
+    // Allocates unshared storage for the given number of bricks. Must only be called on empty sectors.
+    void Reserve(uint32_t numBricks) {
+        Storage = std::make_shared<std::vector<Brick>>();
+        Storage->reserve(numBricks);
+    }
     // Bulk delete bricks indicated by mask
     void DeleteBricks(uint64_t mask);
 
-    uint64_t GetAllocationMask();
+    uint64_t GetAllocationMask() const;
     uint64_t DeleteEmptyBricks(uint64_t mask = ~0ull);
 
     static uint32_t GetBrickIndexFromSlot(uint64_t allocMask, uint32_t slotIdx);
@@ -177,19 +276,36 @@ struct HitResult {
     bool IsMiss() const { return Distance <= 0.0; }
 };
 
+// Read-only copy of map contents, which can be serialized from a background thread.
+struct VoxelMapSnapshot {
+    Material Palette[256] {};
+    std::unordered_map<uint32_t, std::shared_ptr<const Sector>> Sectors;
+
+    // Writes snapshot in the same format as `VoxelMap::Serialize()`.
+    // If `numWrittenSectors` is given, it is incremented after each sector is written.
+    void Serialize(std::ostream& os, std::atomic_uint32_t* numWrittenSectors = nullptr) const;
+};
+
 struct VoxelMap {
     static constexpr glm::ivec3 MinPos = WorldSectorIndexer::MinPos * MaskIndexer::Size * BrickIndexer::Size;
     static constexpr glm::ivec3 MaxPos = WorldSectorIndexer::MaxPos * MaskIndexer::Size * BrickIndexer::Size;
 
     std::unordered_map<uint32_t, Sector> Sectors;
-    std::map<uint32_t, uint64_t> DirtyLocs;         // 4x4x4 masks of dirty bricks
+    // Dirty locations are kept in Z-order so that consumers visit nearby sectors together.
+    std::map<uint32_t, uint64_t, SectorMortonLess> DirtyLocs;    // 4x4x4 masks of dirty bricks
+    std::map<uint32_t, uint64_t, SectorMortonLess> UnsavedLocs;  // Same as DirtyLocs, but only cleared by WorldAutosave
+    std::map<uint32_t, uint64_t, SectorMortonLess> UnhashedLocs; // Same as DirtyLocs, but only cleared by WorldHashTree
 
     Material Palette[256] {};
 
     Brick* GetBrick(glm::ivec3 pos, bool create = false, bool markAsDirty = false);
 
-    Voxel Get(glm::ivec3 pos) {
-        Brick* brick = GetBrick(pos >> BrickIndexer::Shift);
+    Voxel Get(glm::ivec3 pos) const {
+        glm::ivec3 brickPos = pos >> BrickIndexer::Shift;
+        if (!CheckInBounds(pos)) return Voxel::CreateEmpty();
+
+        auto iter = Sectors.find(WorldSectorIndexer::GetIndex(brickPos >> MaskIndexer::Shift));
+        const Brick* brick = iter != Sectors.end() ? iter->second.GetBrick(MaskIndexer::GetIndex(brickPos)) : nullptr;
         return brick ? brick->Data[BrickIndexer::GetIndex(pos)] : Voxel::CreateEmpty();
     }
     void Set(glm::ivec3 pos, Voxel voxel) {
@@ -204,9 +320,25 @@ struct VoxelMap {
         return WorldSectorIndexer::CheckInBounds(pos);
     }
 
+    // Flags bricks in the given sector as modified.
+    // `sector` is an optional pointer to the sector at `sectorIdx`, to avoid an extra lookup.
+    void MarkDirty(uint32_t sectorIdx, uint64_t brickMask, Sector* sector = nullptr) {
+        DirtyLocs[sectorIdx] |= brickMask;
+        UnsavedLocs[sectorIdx] |= brickMask;
+        UnhashedLocs[sectorIdx] |= brickMask;
+
+        if (sector == nullptr) {
+            auto iter = Sectors.find(sectorIdx);
+            sector = iter != Sectors.end() ? &iter->second : nullptr;
+        }
+        if (sector != nullptr) {
+            sector->OccupancyCacheMask &= ~brickMask;
+        }
+    }
+
     void MarkAllDirty() {
-        for (auto& [idx, sector] : Sectors) {
-            DirtyLocs[idx] = sector.GetAllocationMask();
+        for (uint32_t idx : GetMortonOrderedKeys(Sectors)) {
+            DirtyLocs.insert_or_assign(DirtyLocs.end(), idx, Sectors[idx].GetAllocationMask());
         }
     }
 
@@ -214,10 +346,18 @@ struct VoxelMap {
     HitResult RayCast(glm::dvec3 origin, glm::dvec3 dir, uint32_t maxIters = 1024);
 
     void Deserialize(std::string_view filename);
+    void Deserialize(std::istream& is);
     void Serialize(std::string_view filename);
+    // If `mortonOrder` is false, sectors are written in hash map order. Only useful for comparisons.
+    void Serialize(std::ostream& os, bool mortonOrder = true);
 
     void VoxelizeModel(const glim::Model& model, glm::uvec3 pos, glm::uvec3 size);
 
+    // Loads the voxelized model from a file in `cacheDir`, named after a hash of the model's source files
+    // and voxelization parameters. If there's no such file, the model is voxelized and written to it.
+    // Returns true if the model was loaded from cache.
+    bool LoadOrVoxelizeModel(std::string_view modelPath, glm::uvec3 pos, glm::uvec3 size, std::string_view cacheDir);
+
     // Iterates over bricks within the specified region (in voxel coords).
     template<typename F>
     void RegionDispatchSIMD(glm::ivec3 regionMin, glm::ivec3 regionMax, bool createEmpty, F fn) {
@@ -240,7 +380,7 @@ struct VoxelMap {
                         uint32_t sectorIdx = WorldSectorIndexer::GetIndex(brickPos >> MaskIndexer::Shift);
                         uint64_t brickMask = 1ull << MaskIndexer::GetIndex(brickPos);
 
-                        DirtyLocs[sectorIdx] |= brickMask;
+                        MarkDirty(sectorIdx, brickMask);
 
                         if (isEmpty) {
                             emptyBricks[sectorIdx] |= brickMask;
@@ -1,5 +1,11 @@
 #include "VoxelMap.h"
 #include "Common/PaletteBuilder.h"
+#include "Common/BinaryIO.h"
+#include "Common/Hash.h"
+
+#include <filesystem>
+#include <fstream>
+#include <charconv>
 
 // http://research.michael-schwarz.com/publ/files/vox-siga10.pdf
 static void VoxelizeTriangleSurface(const glm::vec3 v[3], std::function<void(glm::ivec3)> visitor) {
@@ -145,4 +151,137 @@ void VoxelMap::VoxelizeModel(const glim::Model& model, glm::uvec3 startPos, glm:
         }
         return true;
     });
-}
\ No newline at end of file
+}
+// Must be bumped whenever VoxelizeModel() changes in a way that affects its output.
+static const uint32_t VoxelizerVersion = 1;
+
+static std::string ReadFileBytes(const std::filesystem::path& path) {
+    std::ifstream is(path, std::ios::binary);
+    if (!is.is_open()) return {};
+
+    return std::string(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>());
+}
+
+// Extracts external buffer and image URIs from glTF JSON. This is not a full parser, but
+// "uri" is only used as a property name for these in the schema. Embedded data URIs are skipped.
+static std::vector<std::string> GetGltfExternalUris(std::string_view json) {
+    std::vector<std::string> uris;
+    size_t pos = 0;
+
+    while ((pos = json.find("\"uri\"", pos)) != std::string_view::npos) {
+        pos = json.find_first_not_of(" \t\r\n:", pos + 5);
+        if (pos == std::string_view::npos || json[pos] != '"') continue;
+
+        std::string uri;
+        for (pos++; pos < json.size() && json[pos] != '"'; pos++) {
+            char ch = json[pos];
+
+            if (ch == '\\' && pos + 1 < json.size()) {
+                ch = json[++pos];
+            } else if (ch == '%' && pos + 2 < json.size()) {
+                uint8_t code;
+                auto res = std::from_chars(&json[pos + 1], &json[pos + 3], code, 16);
+                if (res.ec == std::errc() && res.ptr == &json[pos + 3]) {
+                    ch = (char)code;
+                    pos += 2;
+                }
+            }
+            uri.push_back(ch);
+        }
+        if (!uri.starts_with("data:")) {
+            uris.push_back(std::move(uri));
+        }
+    }
+    return uris;
+}
+
+// Returns the JSON chunk of a binary glTF file, or the whole file for text glTF.
+static std::string_view GetGltfJson(std::string_view data, bool isBinary) {
+    if (!isBinary) return data;
+
+    uint32_t header[5];
+    if (data.size() < sizeof(header)) return {};
+    std::memcpy(header, data.data(), sizeof(header));
+
+    // magic "glTF", version, length, chunk length, chunk type "JSON"
+    if (header[0] != 0x46546C67 || header[4] != 0x4E4F534A) return {};
+    return data.substr(sizeof(header), header[3]);
+}
+
+// Hashes the model file and the external buffers and textures it references. Formats other
+// than glTF can reference files in less structured ways, so for those only the size and
+// modification time of files in the model's directory are considered.
+static uint64_t GetModelCacheKey(const std::filesystem::path& modelPath, glm::uvec3 pos, glm::uvec3 size) {
+    glim::Hasher hasher;
+    hasher.Write(VoxelizerVersion);
+    hasher.Write(pos);
+    hasher.Write(size);
+    hasher.WriteStr(modelPath.filename().string());
+
+    std::string data = ReadFileBytes(modelPath);
+    if (data.empty()) {
+        throw std::runtime_error("Failed to read model file");
+    }
+    hasher.WriteStr(data);
+
+    std::filesystem::path baseDir = modelPath.parent_path();
+    std::string ext = modelPath.extension().string();
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](char ch) { return (char)std::tolower(ch); });
+
+    if (ext == ".gltf" || ext == ".glb") {
+        for (auto& uri : GetGltfExternalUris(GetGltfJson(data, ext == ".glb"))) {
+            // Missing files hash as empty, so that adding them later invalidates the cache.
+            hasher.WriteStr(uri);
+            hasher.WriteStr(ReadFileBytes(baseDir / uri));
+        }
+        return hasher.Finish();
+    }
+
+    if (baseDir.empty()) baseDir = ".";
+    std::vector<std::filesystem::path> files;
+
+    for (auto& entry : std::filesystem::recursive_directory_iterator(baseDir)) {
+        if (entry.is_regular_file()) {
+            files.push_back(entry.path());
+        }
+    }
+    std::sort(files.begin(), files.end());  // directory iteration order is unspecified
+
+    for (auto& path : files) {
+        hasher.WriteStr(std::filesystem::relative(path, baseDir).generic_string());
+        hasher.Write((uint64_t)std::filesystem::file_size(path));
+        hasher.Write((int64_t)std::filesystem::last_write_time(path).time_since_epoch().count());
+    }
+    return hasher.Finish();
+}
+
+bool VoxelMap::LoadOrVoxelizeModel(std::string_view modelPath, glm::uvec3 pos, glm::uvec3 size, std::string_view cacheDir) {
+    uint64_t key = GetModelCacheKey(modelPath, pos, size);
+
+    char fileName[64];
+    snprintf(fileName, sizeof(fileName), "_%016llx.dat", (unsigned long long)key);
+    std::filesystem::path cachePath = std::filesystem::path(cacheDir) / (std::filesystem::path(modelPath).stem().string() + fileName);
+
+    if (std::filesystem::exists(cachePath)) {
+        Deserialize(cachePath.string());
+        return true;
+    }
+
+    // Voxelize into a separate map so that the cache only contains the model.
+    VoxelMap model;
+    model.VoxelizeModel(glim::Model(modelPath), pos, size);
+
+    std::filesystem::create_directories(cacheDir);
+    std::string tempPath = cachePath.string() + ".tmp";
+    model.Serialize(tempPath);
+    glim::io::CommitFile(tempPath, cachePath.string());
+
+    std::memcpy(Palette, model.Palette, sizeof(Palette));
+
+    for (auto& [sectorIdx, sector] : model.Sectors) {
+        uint64_t allocMask = sector.GetAllocationMask();
+        Sector& dest = Sectors[sectorIdx] = std::move(sector);
+        MarkDirty(sectorIdx, allocMask, &dest);
+    }
+    return false;
+}
@@ -0,0 +1,156 @@
+#include "WorldAutosave.h"
+
+#include <fstream>
+#include <Common/BinaryIO.h>
+
+WorldAutosave::WorldAutosave(std::shared_ptr<VoxelMap> map, std::string path) {
+    _map = std::move(map);
+    _path = std::move(path);
+
+    // Initial snapshot is taken from the current map state, so that loaded
+    // maps aren't written back until they are actually modified.
+    // Sector copies only reference brick storage, which is shared until modified.
+    for (auto& [idx, sector] : _map->Sectors) {
+        _snapshot.Sectors[idx] = std::make_shared<const Sector>(sector);
+    }
+    _map->UnsavedLocs.clear();
+
+    _thread = std::jthread(&WorldAutosave::WorkerFn, this);
+}
+WorldAutosave::~WorldAutosave() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _exit = true;
+    lock.unlock();
+
+    _availRequest.notify_one();
+    _thread.join();
+}
+
+void WorldAutosave::Update(bool force) {
+    auto now = Clock::now();
+    bool isDue = Enabled && now - _lastSaveTime >= std::chrono::duration<float>(IntervalSecs);
+
+    // Skip if a previous save is still in progress, it will be retried on the next call.
+    if (!(isDue || force) || _busy) return;
+
+    _lastSaveTime = now;
+
+    // Failed saves are retried even without new edits
+    if (_map->UnsavedLocs.empty() && !_needsWrite && !force) return;
+
+    // Copy modified sectors into the retained snapshot. Bricks are only copied later, if the map modifies them again.
+    for (auto& [sectorIdx, dirtyMask] : _map->UnsavedLocs) {
+        auto iter = _map->Sectors.find(sectorIdx);
+
+        if (iter != _map->Sectors.end()) {
+            _snapshot.Sectors[sectorIdx] = std::make_shared<const Sector>(iter->second);
+        } else {
+            _snapshot.Sectors.erase(sectorIdx);
+        }
+    }
+    uint32_t numCopiedSectors = _map->UnsavedLocs.size();
+    _map->UnsavedLocs.clear();
+
+    std::memcpy(_snapshot.Palette, _map->Palette, sizeof(_snapshot.Palette));
+
+    // Sector data is shared between snapshots, this only copies pointers.
+    auto request = std::make_unique<VoxelMapSnapshot>(_snapshot);
+
+    double captureMs = std::chrono::duration<double, std::milli>(Clock::now() - now).count();
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    _stats.CaptureMs = captureMs;
+    _stats.NumCopiedSectors = numCopiedSectors;
+    _pendingSnapshot = std::move(request);
+    _busy = true;
+    _needsWrite = true;
+
+    lock.unlock();
+    _availRequest.notify_one();
+}
+
+void WorldAutosave::WorkerFn() {
+    while (true) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (_pendingSnapshot == nullptr && !_exit) {
+            _availRequest.wait(lock);
+        }
+        // Pending snapshots are still written on exit to avoid losing edits
+        if (_pendingSnapshot == nullptr) break;
+
+        auto snapshot = std::move(_pendingSnapshot);
+        lock.unlock();
+
+        Write(*snapshot);
+        _busy = false;
+    }
+}
+
+void WorldAutosave::Write(const VoxelMapSnapshot& snapshot) {
+    auto startTime = Clock::now();
+    std::string tempPath = _path + ".tmp";
+    std::string error;
+    uint64_t fileSize = 0;
+
+    _numWrittenSectors = 0;
+    _numTotalSectors = snapshot.Sectors.size();
+
+    try {
+        std::ofstream os(tempPath, std::ios::binary | std::ios::trunc);
+        if (!os.is_open()) {
+            throw std::ios_base::failure("Failed to create file");
+        }
+        snapshot.Serialize(os, &_numWrittenSectors);
+        fileSize = (uint64_t)os.tellp();
+        os.close();
+
+        if (os.fail()) {
+            throw std::ios_base::failure("Failed to write file");
+        }
+        glim::io::CommitFile(tempPath, _path);
+        _needsWrite = false;
+    } catch (std::exception& ex) {
+        error = ex.what();
+    }
+    double writeMs = std::chrono::duration<double, std::milli>(Clock::now() - startTime).count();
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    _stats.WriteMs = writeMs;
+    _stats.LastError = std::move(error);
+
+    if (_stats.LastError.empty()) {
+        _stats.FileSize = fileSize;
+        _stats.NumSaves++;
+    }
+}
+
+void WorldAutosave::DrawSettings(glim::SettingStore& settings) {
+    ImGui::SeparatorText("Autosave");
+
+    ImGui::PushItemWidth(150);
+    settings.Checkbox("Autosave", &Enabled);
+    settings.Drag("Autosave Interval", &IntervalSecs, 1, 5.0f, 3600.0f, 1.0f, "%.0fs");
+    ImGui::PopItemWidth();
+
+    ImGui::BeginDisabled(_busy);
+    if (ImGui::Button("Save Now")) {
+        Update(true);
+    }
+    ImGui::EndDisabled();
+
+    if (_busy) {
+        uint32_t total = std::max(_numTotalSectors.load(), 1u);
+        ImGui::SameLine();
+        ImGui::ProgressBar(_numWrittenSectors / (float)total, ImVec2(150, 0));
+    }
+
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    if (_stats.NumSaves > 0) {
+        ImGui::Text("Capture: %.2fms (%u sectors)", _stats.CaptureMs, _stats.NumCopiedSectors);
+        ImGui::Text("Write: %.1fms (%.1fMB)", _stats.WriteMs, _stats.FileSize / 1048576.0);
+    }
+    if (!_stats.LastError.empty()) {
+        ImGui::TextColored(ImVec4(1.0f, 0.3f, 0.3f, 1.0f), "Save failed: %s", _stats.LastError.data());
+    }
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <Common/SettingStore.h>
+
+#include "VoxelMap.h"
+
+// Periodically saves the map to disk without blocking the main thread.
+//
+// Sectors modified since the last save (tracked by `VoxelMap::UnsavedLocs`) are copied into
+// a retained snapshot on the main thread, which is then compressed and written by a background
+// thread while editing continues. Snapshot sectors share brick storage with the map until it is
+// next modified (see `Sector`), so capture cost and memory overhead are proportional to the
+// number of edited sectors rather than the map size.
+struct WorldAutosave {
+    struct Stats {
+        double CaptureMs = 0;  // Time spent copying dirty sectors on the main thread
+        double WriteMs = 0;    // Time spent compressing and writing on the background thread
+        uint32_t NumCopiedSectors = 0;
+        uint64_t FileSize = 0;
+        uint32_t NumSaves = 0;
+        std::string LastError;
+    };
+
+    float IntervalSecs = 60.0f;
+    bool Enabled = true;
+
+    WorldAutosave(std::shared_ptr<VoxelMap> map, std::string path);
+    ~WorldAutosave();
+
+    // Captures a snapshot and queues it for writing if the save interval has elapsed,
+    // or if `force` is set. Must be called from the thread that owns the map.
+    void Update(bool force = false);
+
+    void DrawSettings(glim::SettingStore& settings);
+
+    bool IsSaving() const { return _busy; }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    std::shared_ptr<VoxelMap> _map;
+    std::string _path;
+
+    VoxelMapSnapshot _snapshot;
+    Clock::time_point _lastSaveTime = Clock::now();
+
+    std::mutex _mutex;
+    std::condition_variable _availRequest;
+    std::unique_ptr<VoxelMapSnapshot> _pendingSnapshot;  // protected by _mutex
+    Stats _stats;                                         // protected by _mutex
+    bool _exit = false;                                   // protected by _mutex
+
+    std::atomic_bool _busy = false;
+    std::atomic_bool _needsWrite = false;  // Set when a snapshot is captured, cleared once it is committed to disk
+    std::atomic_uint32_t _numWrittenSectors = 0, _numTotalSectors = 0;
+
+    std::jthread _thread;
+
+    void WorkerFn();
+    void Write(const VoxelMapSnapshot& snapshot);
+};
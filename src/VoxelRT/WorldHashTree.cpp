@@ -0,0 +1,179 @@
+#include "WorldHashTree.h"
+
+#include <Common/Hash.h>
+
+static glm::uvec3 GetBiasedSectorPos(uint32_t sectorIdx) {
+    return WorldSectorIndexer::GetPos(sectorIdx) - WorldSectorIndexer::MinPos;
+}
+static uint32_t GetSectorIndex(glm::uvec3 biasedPos) {
+    return WorldSectorIndexer::GetIndex(glm::ivec3(biasedPos) + WorldSectorIndexer::MinPos);
+}
+static uint64_t GetChildBit(glm::uvec3 childPos) {
+    return 1ull << MaskIndexer::GetIndex(glm::ivec3(childPos));
+}
+
+void WorldHashTree::Build(VoxelMap& map) {
+    Clear();
+
+    for (auto& [sectorIdx, sector] : map.Sectors) {
+        UpdateSector(sectorIdx, &sector, ~0ull);
+    }
+    map.UnhashedLocs.clear();
+    Propagate();
+}
+void WorldHashTree::Build(const VoxelMapSnapshot& snapshot) {
+    Clear();
+
+    for (auto& [sectorIdx, sector] : snapshot.Sectors) {
+        UpdateSector(sectorIdx, sector.get(), ~0ull);
+    }
+    Propagate();
+}
+
+void WorldHashTree::Update(VoxelMap& map) {
+    if (map.UnhashedLocs.empty()) return;
+
+    for (auto [sectorIdx, brickMask] : map.UnhashedLocs) {
+        auto iter = map.Sectors.find(sectorIdx);
+        UpdateSector(sectorIdx, iter != map.Sectors.end() ? &iter->second : nullptr, brickMask);
+    }
+    map.UnhashedLocs.clear();
+    Propagate();
+}
+
+uint64_t WorldHashTree::GetRootHash() const {
+    auto iter = _levels[NumLevels - 1].find(0);
+    return iter != _levels[NumLevels - 1].end() ? iter->second.Hash : 0;
+}
+uint64_t WorldHashTree::GetSectorHash(uint32_t sectorIdx) const {
+    auto iter = _sectors.find(sectorIdx);
+    return iter != _sectors.end() ? iter->second.Hash : 0;
+}
+
+void WorldHashTree::Clear() {
+    _sectors.clear();
+    _pendingNodes.clear();
+
+    for (auto& level : _levels) {
+        level.clear();
+    }
+}
+
+void WorldHashTree::UpdateSector(uint32_t sectorIdx, const Sector* sector, uint64_t brickMask) {
+    uint64_t allocMask = sector != nullptr ? sector->GetAllocationMask() : 0;
+    auto iter = _sectors.find(sectorIdx);
+
+    if (allocMask == 0) {
+        if (iter == _sectors.end()) return;
+        _sectors.erase(iter);
+    } else {
+        if (iter == _sectors.end()) {
+            iter = _sectors.insert({ sectorIdx, SectorHashes{} }).first;
+        }
+        SectorHashes& node = iter->second;
+
+        // Newly allocated bricks may not have been flagged as dirty
+        for (uint32_t i : BitIter((brickMask | ~node.AllocMask) & allocMask)) {
+            glim::Hasher hasher;
+            hasher.Write(*sector->GetBrick(i));
+            node.BrickHashes[i] = hasher.Finish();
+        }
+        glim::Hasher hasher;
+        hasher.Write(allocMask);
+
+        for (uint32_t i : BitIter(allocMask)) {
+            hasher.Write(node.BrickHashes[i]);
+        }
+        uint64_t hash = hasher.Finish();
+
+        if (node.AllocMask == allocMask && node.Hash == hash) return;
+
+        node.AllocMask = allocMask;
+        node.Hash = hash;
+    }
+    glm::uvec3 pos = GetBiasedSectorPos(sectorIdx);
+    _pendingNodes[GetNodeKey(pos / 4u)] |= GetChildBit(pos);
+}
+
+void WorldHashTree::Propagate() {
+    for (uint32_t level = 0; level < NumLevels; level++) {
+        std::unordered_map<uint32_t, uint64_t> parents;
+
+        for (auto [key, changedChildren] : _pendingNodes) {
+            glm::uvec3 pos = GetNodePos(key);
+            Node& node = _levels[level][key];
+
+            // Update child existence bits
+            for (uint32_t i : BitIter(changedChildren)) {
+                glm::uvec3 childPos = pos * 4u + glm::uvec3(MaskIndexer::GetPos(i));
+                bool exists = level == 0 ? _sectors.contains(GetSectorIndex(childPos))
+                                         : _levels[level - 1].contains(GetNodeKey(childPos));
+                node.ChildMask = (node.ChildMask & ~(1ull << i)) | (uint64_t)exists << i;
+            }
+
+            if (node.ChildMask == 0) {
+                _levels[level].erase(key);
+            } else {
+                glim::Hasher hasher;
+                hasher.Write(node.ChildMask);
+
+                for (uint32_t i : BitIter(node.ChildMask)) {
+                    glm::uvec3 childPos = pos * 4u + glm::uvec3(MaskIndexer::GetPos(i));
+                    hasher.Write(level == 0 ? _sectors[GetSectorIndex(childPos)].Hash
+                                            : _levels[level - 1][GetNodeKey(childPos)].Hash);
+                }
+                node.Hash = hasher.Finish();
+            }
+            parents[GetNodeKey(pos / 4u)] |= GetChildBit(pos);
+        }
+        _pendingNodes = std::move(parents);
+    }
+    _pendingNodes.clear();
+}
+
+WorldHashTree::LocMap WorldHashTree::Diff(const WorldHashTree& a, const WorldHashTree& b) {
+    LocMap changes;
+    DiffNode(a, b, NumLevels - 1, glm::uvec3(0), changes);
+    return changes;
+}
+
+void WorldHashTree::DiffNode(const WorldHashTree& a, const WorldHashTree& b, int32_t level, glm::uvec3 pos, LocMap& changes) {
+    if (level < 0) {
+        DiffSector(a, b, GetSectorIndex(pos), changes);
+        return;
+    }
+    auto nodeA = a._levels[level].find(GetNodeKey(pos));
+    auto nodeB = b._levels[level].find(GetNodeKey(pos));
+    bool hasA = nodeA != a._levels[level].end();
+    bool hasB = nodeB != b._levels[level].end();
+
+    if (hasA && hasB && nodeA->second.Hash == nodeB->second.Hash) return;
+
+    uint64_t childMask = (hasA ? nodeA->second.ChildMask : 0) | (hasB ? nodeB->second.ChildMask : 0);
+
+    for (uint32_t i : BitIter(childMask)) {
+        DiffNode(a, b, level - 1, pos * 4u + glm::uvec3(MaskIndexer::GetPos(i)), changes);
+    }
+}
+
+void WorldHashTree::DiffSector(const WorldHashTree& a, const WorldHashTree& b, uint32_t sectorIdx, LocMap& changes) {
+    auto sectorA = a._sectors.find(sectorIdx);
+    auto sectorB = b._sectors.find(sectorIdx);
+    bool hasA = sectorA != a._sectors.end();
+    bool hasB = sectorB != b._sectors.end();
+
+    if (hasA && hasB && sectorA->second.Hash == sectorB->second.Hash) return;
+
+    uint64_t maskA = hasA ? sectorA->second.AllocMask : 0;
+    uint64_t maskB = hasB ? sectorB->second.AllocMask : 0;
+    uint64_t diffMask = maskA ^ maskB;
+
+    for (uint32_t i : BitIter(maskA & maskB)) {
+        if (sectorA->second.BrickHashes[i] != sectorB->second.BrickHashes[i]) {
+            diffMask |= 1ull << i;
+        }
+    }
+    if (diffMask != 0) {
+        changes[sectorIdx] = diffMask;
+    }
+}
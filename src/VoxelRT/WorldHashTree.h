@@ -0,0 +1,60 @@
+#pragma once
+
+#include <unordered_map>
+
+#include "VoxelMap.h"
+
+// Incrementally maintained content hashes over the world, for diffing different versions of a map.
+//
+// Bricks and sectors are hashed individually, and a hierarchy of 4x4x4 nodes is built over
+// `WorldSectorIndexer` space up to a single root. Each node hashes the hashes of its children,
+// so two trees can be compared by descending only into nodes whose hashes differ.
+// Empty sectors are treated the same as missing ones.
+struct WorldHashTree {
+    // Number of levels above sectors, enough to cover 4096x256x4096 sectors with a single root.
+    static constexpr uint32_t NumLevels = (WorldSectorIndexer::ShiftXZ + 1) / 2;
+    static_assert(WorldSectorIndexer::ShiftXZ >= WorldSectorIndexer::ShiftY);
+
+    using LocMap = std::map<uint32_t, uint64_t, SectorMortonLess>;
+
+    // Rebuilds the tree from scratch, and clears `map.UnhashedLocs`.
+    void Build(VoxelMap& map);
+    void Build(const VoxelMapSnapshot& snapshot);
+
+    // Re-hashes bricks flagged in `map.UnhashedLocs` and propagates changes up the tree.
+    void Update(VoxelMap& map);
+
+    uint64_t GetRootHash() const;
+    uint64_t GetSectorHash(uint32_t sectorIdx) const;
+    uint32_t GetNumSectors() const { return (uint32_t)_sectors.size(); }
+
+    // Returns masks of bricks that differ between the two trees, keyed by sector index (same as VoxelMap::DirtyLocs).
+    // Bricks that only exist in one of the trees are also included. Cost is proportional to the number of changes.
+    static LocMap Diff(const WorldHashTree& a, const WorldHashTree& b);
+
+private:
+    struct SectorHashes {
+        uint64_t Hash;
+        uint64_t AllocMask;
+        uint64_t BrickHashes[MaskIndexer::MaxArea];
+    };
+    struct Node {
+        uint64_t Hash;
+        uint64_t ChildMask;
+    };
+
+    std::unordered_map<uint32_t, SectorHashes> _sectors;
+    std::unordered_map<uint32_t, Node> _levels[NumLevels];  // Keyed by GetNodeKey(), level 0 is the parent of sectors.
+
+    std::unordered_map<uint32_t, uint64_t> _pendingNodes;  // Level 0 nodes with changed children
+
+    void Clear();
+    void UpdateSector(uint32_t sectorIdx, const Sector* sector, uint64_t brickMask);
+    void Propagate();
+
+    static uint32_t GetNodeKey(glm::uvec3 pos) { return pos.x | pos.z << 12 | pos.y << 24; }
+    static glm::uvec3 GetNodePos(uint32_t key) { return { key & 4095, key >> 24, key >> 12 & 4095 }; }
+
+    static void DiffNode(const WorldHashTree& a, const WorldHashTree& b, int32_t level, glm::uvec3 pos, LocMap& changes);
+    static void DiffSector(const WorldHashTree& a, const WorldHashTree& b, uint32_t sectorIdx, LocMap& changes);
+};